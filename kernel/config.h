@@ -1,20 +1,34 @@
 #ifndef _CONFIG_H_
 #define _CONFIG_H_
 
-// we use only one HART (cpu) in fundamental experiments
-#define NCPU 1
+// the maximum number of HARTs (cpus). the kernel runs on all the harts spike is started
+// with (-p N), harts beyond NCPU are parked.
+#define NCPU 8
 
 #define DRAM_BASE 0x80000000
 
-/* we use fixed physical (also logical) addresses for the stacks and trap frames as in
- Bare memory-mapping mode */
-// user stack top
-#define USER_STACK 0x81100000
+/* kernel stacks and trap frames are allocated from the buddy page allocator (kernel/pmm.c)
+ when a user "process" is assembled. */
+// the stack used by PKE kernel when a syscall happens: 2^USER_KSTACK_ORDER pages
+#define USER_KSTACK_ORDER 1
 
-// the stack used by PKE kernel when a syscall happens
-#define USER_KSTACK 0x81200000
+// size of the user stack area. its pages are populated on demand.
+#define USER_STACK_SIZE 0x100000
 
-// the trap frame used to assemble the user "process"
-#define USER_TRAP_FRAME 0x81300000
+// interval of the timer ticks, in units of mtime (10 MHz on spike, i.e., 10ms here), and
+// the time slice of a process, in ticks.
+#define TIMER_INTERVAL 100000
+#define SCHED_TIME_SLICE 2
+
+// maximum number of processes (the size of the process table, see kernel/process.c)
+#define NPROC 64
+
+// maximum number of open files (descriptors) of a process
+#define NOFILE 16
+
+// the page cache of host files (kernel/pcache.c) holds at most this percentage of the
+// emulated memory, and reads ahead at most 2^PCACHE_RA_MAX_ORDER pages at once.
+#define PCACHE_MEM_PERCENT 12
+#define PCACHE_RA_MAX_ORDER 4
 
 #endif
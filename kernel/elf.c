@@ -1,35 +1,150 @@
 /*
- * routines that scan and load a (host) Executable and Linkable Format (ELF) file
- * into the (emulated) memory.
+ * routines that scan and load an Executable and Linkable Format (ELF) file (from the
+ * initramfs or the host) into the (emulated) memory.
  */
 
 #include "elf.h"
 #include "string.h"
 #include "riscv.h"
+#include "vmm.h"
+#include "vma.h"
+#include "pcache.h"
+#include "file.h"
+#include "ramfs.h"
+#include "pmm.h"
+#include "lz4.h"
+#include "util/functions.h"
 #include "spike_interface/spike_utils.h"
 
 typedef struct elf_info_t {
-  spike_file_t *f;
+  kfile *f;
   process *p;
 } elf_info;
 
 //
-// the implementation of allocater. allocates memory space for later segment loading
+// register a program segment as a VMA of the process, backed by the elf file. nothing is
+// read here: each page is read from the file on its first access (see vma_fault() in
+// kernel/vma.c).
 //
-static void *elf_alloc_mb(elf_ctx *ctx, uint64 elf_pa, uint64 elf_va, uint64 size) {
-  // directly returns the virtual address as we are in the Bare mode in lab1_x
-  return (void *)elf_va;
+static elf_status elf_map_segment(elf_ctx *ctx, elf_prog_header *ph, int prot) {
+  elf_info *msg = (elf_info *)ctx->info;
+
+  if (vma_add(msg->p, ph->vaddr, ph->vaddr + ph->memsz, prot, msg->f, ph->off, ph->vaddr,
+        ph->vaddr + ph->filesz) == NULL)
+    return EL_ERR;
+
+  return EL_OK;
+}
+
+//
+// add the host reads the calling hart has issued since its counters were at reads and
+// bytes (see spike_file_host_reads()) to the traffic of this load.
+//
+static void elf_count_host_reads(elf_ctx *ctx, uint64 reads, uint64 bytes) {
+  uint64 now_reads, now_bytes;
+  spike_file_host_reads(&now_reads, &now_bytes);
+  ctx->host_reads += now_reads - reads;
+  ctx->host_bytes += now_bytes - bytes;
 }
 
 //
-// actual file reading, using the spike file interface.
+// actual file reading, through the operations of the open file (see kernel/file.c).
 //
 static uint64 elf_fpread(elf_ctx *ctx, void *dest, uint64 nb, uint64 offset) {
   elf_info *msg = (elf_info *)ctx->info;
-  // call spike file utility to load the content of elf file into memory.
-  // spike_file_pread will read the elf file (msg->f) from offset to memory (indicated by
-  // *dest) for nb bytes.
-  return spike_file_pread(msg->f, dest, nb, offset);
+  uint64 reads, bytes;
+  spike_file_host_reads(&reads, &bytes);
+  // read the elf file (msg->f) from offset to memory (indicated by *dest) for nb bytes.
+  // host files are read through the page cache, files of the initramfs from memory.
+  uint64 r = msg->f->ops->read(msg->f, dest, nb, offset);
+  elf_count_host_reads(ctx, reads, bytes);
+  return r;
+}
+
+//
+// prefetch a range of the elf file, for files that support it (host files).
+//
+static void elf_fprefetch(elf_ctx *ctx, uint64 offset, uint64 nb) {
+  elf_info *msg = (elf_info *)ctx->info;
+  if (msg->f->ops->prefetch == NULL) return;
+  uint64 reads, bytes;
+  spike_file_host_reads(&reads, &bytes);
+  msg->f->ops->prefetch(msg->f, offset, nb);
+  elf_count_host_reads(ctx, reads, bytes);
+}
+
+//
+// load a packed segment: its LZ4 block of csize bytes is read and decompressed straight
+// into the pages of the segment, which are mapped right away (instead of on demand).
+//
+static elf_status elf_map_packed_segment(elf_ctx *ctx, elf_prog_header *ph, int prot,
+                                         uint64 csize) {
+  elf_info *msg = (elf_info *)ctx->info;
+
+  // the pages the file bytes fall in, filled as one physically contiguous block.
+  uint64 start = ROUNDDOWN(ph->vaddr, PGSIZE);
+  uint64 npages = (ROUNDUP(ph->vaddr + ph->filesz, PGSIZE) - start) / PGSIZE;
+  int order = 0, in_order = 0;
+  while ((1UL << order) < npages) order++;
+  while ((PGSIZE << in_order) < csize) in_order++;
+
+  vm_area *vma = vma_add(msg->p, ph->vaddr, ph->vaddr + ph->memsz, prot, NULL, 0, 0, 0);
+  if (vma == NULL) return EL_ERR;
+
+  uint8 *out = (uint8 *)alloc_pages(order);
+  uint8 *in = (uint8 *)alloc_pages(in_order);
+  if (out == NULL || in == NULL) {
+    if (out) free_pages(out, order);
+    if (in) free_pages(in, in_order);
+    return EL_ENOMEM;
+  }
+
+  elf_status ret = EL_OK;
+  memset(out, 0, npages * PGSIZE);
+  if (elf_fpread(ctx, in, csize, ph->off) != csize)
+    ret = EL_EIO;
+  else if (lz4_decompress(in, csize, out + (ph->vaddr - start), ph->filesz) != ph->filesz)
+    ret = EL_ERR;
+  free_pages(in, in_order);
+
+  // the pages of the block are handed out (or back) one by one.
+  for (uint64 i = 0; i < (1UL << order); i++) {
+    if (ret == EL_OK && i < npages)
+      user_vm_map(msg->p->pagetable, start + i * PGSIZE, PGSIZE, (uint64)out + i * PGSIZE,
+                  prot_to_type(prot, 1));
+    else
+      free_page(out + i * PGSIZE);
+  }
+  return ret;
+}
+
+//
+// parse the note of filesz bytes at off. if it marks a packed image, copy the entries of
+// the segments stored as LZ4 blocks (at most max) to table, and return their number.
+// returns 0 for other notes, and -1 for a packed image that cannot be loaded.
+//
+static int elf_parse_lz4_note(elf_ctx *ctx, uint64 off, uint64 filesz, elf_lz4_entry *table,
+                              int max) {
+  elf_note_header nh;
+  char name[sizeof(PKE_NOTE_NAME)];
+  uint64 desc_off = off + sizeof(nh) + ROUNDUP(sizeof(name), 4);
+
+  if (filesz < desc_off - off + sizeof(uint64)) return 0;
+  if (elf_fpread(ctx, &nh, sizeof(nh), off) != sizeof(nh)) return 0;
+  if (nh.type != NT_PKE_LZ4 || nh.namesz != sizeof(name)) return 0;
+  if (elf_fpread(ctx, name, sizeof(name), off + sizeof(nh)) != sizeof(name) ||
+      name[sizeof(name) - 1] != 0 || strcmp(name, PKE_NOTE_NAME) != 0)
+    return 0;
+
+  // from here on, the image is packed: it must not be loaded as a plain one.
+  uint64 n;
+  if (elf_fpread(ctx, &n, sizeof(n), desc_off) != sizeof(n) || n > max ||
+      sizeof(n) + n * sizeof(elf_lz4_entry) > nh.descsz ||
+      desc_off - off + nh.descsz > filesz)
+    return -1;
+  uint64 nb = n * sizeof(elf_lz4_entry);
+  if (elf_fpread(ctx, table, nb, desc_off + sizeof(n)) != nb) return -1;
+  return n;
 }
 
 //
@@ -37,8 +152,10 @@ static uint64 elf_fpread(elf_ctx *ctx, void *dest, uint64 nb, uint64 offset) {
 //
 elf_status elf_init(elf_ctx *ctx, void *info) {
   ctx->info = info;
+  ctx->host_reads = ctx->host_bytes = 0;
 
-  // load the elf header
+  // load the elf header. the read brings in the whole first page, which holds the program
+  // header table as well in most binaries.
   if (elf_fpread(ctx, &ctx->ehdr, sizeof(ctx->ehdr), 0) != sizeof(ctx->ehdr)) return EL_EIO;
 
   // check the signature (magic value) of the elf
@@ -48,30 +165,119 @@ elf_status elf_init(elf_ctx *ctx, void *info) {
 }
 
 //
-// load the elf segments to memory regions as we are in Bare mode in lab1
+// register the PT_LOAD segment ph, and extend *image_end over it. csize is the size of its
+// LZ4 block in a packed image, 0 for a plain segment.
+//
+static elf_status elf_load_segment(elf_ctx *ctx, elf_prog_header *ph, uint64 csize,
+                                   uint64 *image_end) {
+  if (ph->memsz < ph->filesz) return EL_ERR;
+  if (ph->vaddr + ph->memsz < ph->vaddr) return EL_ERR;
+
+  // translate the segment flags into the permissions of its pages.
+  int prot = 0;
+  if (ph->flags & SEGMENT_READABLE) prot |= PROT_READ;
+  if (ph->flags & SEGMENT_WRITABLE) prot |= PROT_WRITE;
+  if (ph->flags & SEGMENT_EXECUTABLE) prot |= PROT_EXEC;
+
+  // lazy loading: a plain segment is read page by page when the pages are touched.
+  elf_status ret = csize ? elf_map_packed_segment(ctx, ph, prot, csize)
+                         : elf_map_segment(ctx, ph, prot);
+  if (ret != EL_OK) return ret;
+  *image_end = MAX(*image_end, ph->vaddr + ph->memsz);
+  return EL_OK;
+}
+
+//
+// bring the file ranges of the segments (their first pages, see elf_load()) into the page
+// cache before the first page faults, with the fewest host requests: the ranges are
+// sorted, ranges that overlap or lie within a page of each other are merged, and each
+// merged range is read in blocks of up to 2^PCACHE_RA_MAX_ORDER pages (the scratch buffer
+// of pcache_prefetch()). at most ELF_PREFETCH_LIMIT bytes are read ahead per load.
+//
+static void elf_prefetch(elf_ctx *ctx, elf_range *ranges, int n) {
+  // insertion sort by start offset; n is small.
+  for (int i = 1; i < n; i++) {
+    elf_range r = ranges[i];
+    int j = i - 1;
+    for (; j >= 0 && ranges[j].start > r.start; j--) ranges[j + 1] = ranges[j];
+    ranges[j + 1] = r;
+  }
+
+  uint64 budget = ELF_PREFETCH_LIMIT;
+  for (int i = 0; i < n && budget > 0;) {
+    uint64 start = ROUNDDOWN(ranges[i].start, PGSIZE), end = ranges[i].end;
+    for (i++; i < n && ranges[i].start <= ROUNDUP(end, PGSIZE); i++)
+      end = MAX(end, ranges[i].end);
+
+    uint64 len = MIN(ROUNDUP(end, PGSIZE) - start, budget);
+    elf_fprefetch(ctx, start, len);
+    budget -= len;
+  }
+}
+
+//
+// load the elf segments to memory regions. the segments are registered as VMAs of the
+// process, and demand-paged from the elf file. in a packed image (see tools/elf_pack.c),
+// the segments stored as LZ4 blocks are decompressed into their pages right away.
 //
 elf_status elf_load(elf_ctx *ctx) {
-  // elf_prog_header structure is defined in kernel/elf.h
-  elf_prog_header ph_addr;
-  int i, off;
+  elf_info *msg = (elf_info *)ctx->info;
+  uint64 image_end = 0;
+  // file ranges of the segments, prefetched once all headers are parsed.
+  elf_range ranges[ELF_MAX_RANGES];
+  int nranges = 0;
+  // the LZ4 blocks of a packed image, from its note.
+  elf_lz4_entry packed[ELF_MAX_RANGES];
+  int npacked = 0;
 
-  // traverse the elf program segment headers
-  for (i = 0, off = ctx->ehdr.phoff; i < ctx->ehdr.phnum; i++, off += sizeof(ph_addr)) {
-    // read segment headers
-    if (elf_fpread(ctx, (void *)&ph_addr, sizeof(ph_addr), off) != sizeof(ph_addr)) return EL_EIO;
+  uint64 phnum = ctx->ehdr.phnum, phoff = ctx->ehdr.phoff;
+  if (phnum && ctx->ehdr.phentsize != sizeof(elf_prog_header)) return EL_ERR;
 
-    if (ph_addr.type != ELF_PROG_LOAD) continue;
-    if (ph_addr.memsz < ph_addr.filesz) return EL_ERR;
-    if (ph_addr.vaddr + ph_addr.memsz < ph_addr.vaddr) return EL_ERR;
+  // the program header table is read in pieces of (at most) a page, with one page cache
+  // request each, after one prefetch of the whole table.
+  elf_prog_header *phs = (elf_prog_header *)alloc_page();
+  if (phs == NULL) return EL_ENOMEM;
+  elf_fprefetch(ctx, phoff, phnum * sizeof(elf_prog_header));
 
-    // allocate memory block before elf loading
-    void *dest = elf_alloc_mb(ctx, ph_addr.vaddr, ph_addr.vaddr, ph_addr.memsz);
+  const uint64 per_page = PGSIZE / sizeof(elf_prog_header);
+  elf_status ret = EL_OK;
+  // traverse the elf program segment headers
+  for (uint64 i = 0; i < phnum && ret == EL_OK; i++) {
+    if (i % per_page == 0) {
+      uint64 nb = MIN(per_page, phnum - i) * sizeof(elf_prog_header);
+      if (elf_fpread(ctx, phs, nb, phoff + i * sizeof(elf_prog_header)) != nb) {
+        ret = EL_EIO;
+        break;
+      }
+    }
+
+    elf_prog_header *ph = &phs[i % per_page];
+    if (ph->type == ELF_PROG_NOTE && npacked == 0 &&
+        (npacked = elf_parse_lz4_note(ctx, ph->off, ph->filesz, packed, ELF_MAX_RANGES)) < 0) {
+      ret = EL_ERR;
+      break;
+    }
+    if (ph->type != ELF_PROG_LOAD || ph->memsz == 0) continue;
 
-    // actual loading
-    if (elf_fpread(ctx, dest, ph_addr.memsz, ph_addr.off) != ph_addr.memsz)
-      return EL_EIO;
+    uint64 csize = 0;
+    for (int k = 0; k < npacked; k++)
+      if (packed[k].phidx == i) csize = packed[k].csize;
+    ret = elf_load_segment(ctx, ph, csize, &image_end);
+    // only the page the segment starts in (the entry point, the start of the data) is read
+    // ahead. the startup cost stays with the pages that are touched, see kernel/vma.c.
+    if (csize == 0 && ph->filesz && nranges < ELF_MAX_RANGES)
+      ranges[nranges++] =
+          (elf_range){ph->off, MIN(ph->off + ph->filesz, ROUNDDOWN(ph->off, PGSIZE) + PGSIZE)};
   }
+  free_page(phs);
+  if (ret != EL_OK) return ret;
 
+  // the heap is an empty anonymous area following the image, grown by sys_user_sbrk().
+  msg->p->heap_start = msg->p->brk = ROUNDUP(image_end, PGSIZE);
+  msg->p->heap = vma_add(msg->p, msg->p->brk, msg->p->brk, PROT_READ | PROT_WRITE, NULL, 0, 0, 0);
+  if (msg->p->heap == NULL) return EL_ERR;
+
+  elf_prefetch(ctx, ranges, nranges);
   return EL_OK;
 }
 
@@ -80,9 +286,19 @@ typedef union {
   char *argv[MAX_CMDLINE_ARGS];
 } arg_buf;
 
+//
+// the value of the command line option "key=value" in arg, or NULL if arg is not that option.
+//
+static const char *arg_value(const char *arg, const char *key) {
+  for (; *key; key++, arg++)
+    if (*arg != *key) return NULL;
+  return *arg == '=' ? arg + 1 : NULL;
+}
+
 //
 // returns the number (should be 1) of string(s) after PKE kernel in command line.
-// and store the string(s) in arg_bug_msg.
+// and store the string(s) in arg_bug_msg. an option "initrd=<archive>" in front of the
+// application name loads the cpio archive as the initramfs, and is not returned.
 //
 static size_t parse_args(arg_buf *arg_bug_msg) {
   // HTIFSYS_getmainvars frontend call reads command arguments to (input) *arg_bug_msg
@@ -94,6 +310,11 @@ static size_t parse_args(arg_buf *arg_bug_msg) {
   uint64 *pk_argv = &arg_bug_msg->buf[1];
 
   int arg = 1;  // skip the PKE OS kernel string, leave behind only the application name
+  for (const char *archive; arg < pk_argc; arg++) {
+    if ((archive = arg_value((const char *)(uintptr_t)pk_argv[arg], "initrd")) == NULL) break;
+    // ramfs_load() is defined in kernel/ramfs.c
+    if (ramfs_load(archive) < 0) panic("Fail to load the initramfs %s.\n", archive);
+  }
   for (size_t i = 0; arg + i < pk_argc; i++)
     arg_bug_msg->argv[i] = (char *)(uintptr_t)pk_argv[arg + i];
 
@@ -101,40 +322,59 @@ static size_t parse_args(arg_buf *arg_bug_msg) {
   return pk_argc - arg;
 }
 
+// the command line. the names of the applications point into it, so it is kept.
+static arg_buf cmdline;
+
 //
-// load the elf of user application, by using the spike file interface.
+// read the command line, and return the names of the applications on it (in *apps) and
+// their number. each application runs as a process of its own.
 //
-void load_bincode_from_host_elf(process *p) {
-  arg_buf arg_bug_msg;
-
-  // retrieve command line arguements
-  size_t argc = parse_args(&arg_bug_msg);
-  if (!argc) panic("You need to specify the application program!\n");
+size_t get_cmdline_apps(char ***apps) {
+  size_t argc = parse_args(&cmdline);
+  *apps = cmdline.argv;
+  return argc;
+}
 
-  sprint("Application: %s\n", arg_bug_msg.argv[0]);
+//
+// load the elf of the user application at path into process p, from the initramfs or
+// the host. returns 0, or -1 if the file cannot be opened or is not a loadable elf (the
+// areas added to p so far are left to the caller to remove).
+//
+int load_bincode_from_host_elf(process *p, const char *path) {
+  sprint("Application: %s\n", path);
 
   //elf loading. elf_ctx is defined in kernel/elf.h, used to track the loading process.
   elf_ctx elfloader;
   // elf_info is defined above, used to tie the elf file and its corresponding process.
   elf_info info;
 
-  info.f = spike_file_open(arg_bug_msg.argv[0], O_RDONLY, 0);
+  // the application is taken from the initramfs if it is there, or else from the host.
+  // file_open() is defined in kernel/file.c
+  info.f = file_open(path, O_RDONLY, 0);
   info.p = p;
-  // IS_ERR_VALUE is a macro defined in spike_interface/spike_htif.h
-  if (IS_ERR_VALUE(info.f)) panic("Fail on openning the input application program.\n");
+  if (info.f == NULL) {
+    sprint("Fail on openning the input application program.\n");
+    return -1;
+  }
 
-  // init elfloader context. elf_init() is defined above.
-  if (elf_init(&elfloader, &info) != EL_OK)
-    panic("fail to init elfloader.\n");
+  // init elfloader context, and load elf. elf_init() and elf_load() are defined above.
+  if (elf_init(&elfloader, &info) != EL_OK || elf_load(&elfloader) != EL_OK) {
+    sprint("Fail on loading elf %s.\n", path);
+    file_put(info.f);
+    return -1;
+  }
 
-  // load elf. elf_load() is defined above.
-  if (elf_load(&elfloader) != EL_OK) panic("Fail on loading elf.\n");
+  // counted by elf_fpread() and elf_fprefetch().
+  sprint("elf loaded with %ld host reads, %ld bytes.\n", elfloader.host_reads,
+         elfloader.host_bytes);
 
-  // entry (virtual, also physical in lab1_x) address
+  // entry (virtual) address
   p->trapframe->epc = elfloader.ehdr.entry;
 
-  // close the host spike file
-  spike_file_close( info.f );
+  // drop the reference of the loader. the VMAs of the segments hold their own references
+  // to the file, so it stays open for demand paging, and is closed with the last of them.
+  file_put(info.f);
 
   sprint("Application program entry point (virtual address): 0x%lx\n", p->trapframe->epc);
+  return 0;
 }
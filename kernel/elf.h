@@ -39,6 +39,30 @@ typedef struct elf_prog_header_t {
 
 #define ELF_MAGIC 0x464C457FU  // "\x7FELF" in little endian
 #define ELF_PROG_LOAD 1
+#define ELF_PROG_NOTE 4
+
+// note header, followed by the name and the descriptor (each padded to 4 bytes).
+typedef struct elf_note_header_t {
+  uint32 namesz;
+  uint32 descsz;
+  uint32 type;
+} elf_note_header;
+
+// packed images (made by tools/elf_pack.c) carry a note named "PKE" of type NT_PKE_LZ4,
+// which must come before the PT_LOAD segments in the program header table. its descriptor
+// is a count followed by entries, one for each PT_LOAD segment whose file bytes (at off,
+// filesz bytes once decompressed) are stored as an LZ4 block of csize bytes.
+#define PKE_NOTE_NAME "PKE"
+#define NT_PKE_LZ4 0x345a4c01
+typedef struct elf_lz4_entry_t {
+  uint64 phidx;  // index of the segment in the program header table
+  uint64 csize;  // size of the LZ4 block
+} elf_lz4_entry;
+
+// flags of program segments, see elf_prog_header.flags
+#define SEGMENT_EXECUTABLE 0x1
+#define SEGMENT_WRITABLE 0x2
+#define SEGMENT_READABLE 0x4
 
 typedef enum elf_status_t {
   EL_OK = 0,
@@ -53,11 +77,24 @@ typedef enum elf_status_t {
 typedef struct elf_ctx_t {
   void *info;
   elf_header ehdr;
+  // host requests and bytes read for this load, by the calling hart
+  uint64 host_reads, host_bytes;
 } elf_ctx;
 
+// a range [start, end) of the elf file
+typedef struct elf_range_t {
+  uint64 start, end;
+} elf_range;
+
+// the first page of at most ELF_MAX_RANGES segments is prefetched, ELF_PREFETCH_LIMIT
+// bytes in total. the rest of a segment is read when its pages are touched.
+#define ELF_MAX_RANGES 16
+#define ELF_PREFETCH_LIMIT (16UL << 12)
+
 elf_status elf_init(elf_ctx *ctx, void *info);
 elf_status elf_load(elf_ctx *ctx);
 
-void load_bincode_from_host_elf(process *p);
+size_t get_cmdline_apps(char ***apps);
+int load_bincode_from_host_elf(process *p, const char *path);
 
 #endif
@@ -0,0 +1,277 @@
+/*
+ * open files of user processes.
+ *
+ * a kfile is the kernel side of an open file, shared by all descriptors dup()ed from it.
+ * what it reads and writes depends on its kfile_ops: files of the initramfs (kernel/ramfs.c),
+ * host files (through the spike file interface and the page cache), and the console. a
+ * path found in the initramfs is served from memory, other paths are opened on the host.
+ *
+ * reads and writes move data between the object and kernel (physical) buffers. the
+ * syscall layer passes the user pages themselves as these buffers, so large transfers
+ * are not copied through the kernel.
+ */
+
+#include <errno.h>
+
+#include "file.h"
+#include "pcache.h"
+#include "process.h"
+#include "ramfs.h"
+#include "sched.h"
+#include "slab.h"
+#include "riscv.h"
+#include "string.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+// reads of host files of at least this size bypass the page cache and go straight into
+// the destination.
+#define FILE_DIRECT_READ_MIN (4 * 4096)
+
+static kmem_cache *kfile_cache;
+
+/* --- host files --- */
+
+static ssize_t host_read(kfile *f, void *buf, size_t n, uint64 off) {
+  spike_file_t *sf = (spike_file_t *)f->priv;
+  if (n >= FILE_DIRECT_READ_MIN) return spike_file_pread(sf, buf, n, off);
+  return pcache_pread(sf, buf, n, off);
+}
+
+static ssize_t host_write(kfile *f, const void *buf, size_t n, uint64 off) {
+  spike_file_t *sf = (spike_file_t *)f->priv;
+  ssize_t r = spike_file_pwrite(sf, buf, n, off);
+  // the file changed: the cached pages of it are stale.
+  if (r > 0) pcache_invalidate(sf);
+  return r;
+}
+
+//
+// the host has answered the request of process arg (see host_user_io()).
+//
+static void host_io_done(void *arg, long ret) {
+  process *p = (process *)arg;
+  p->hio.ret = ret;
+  mb();
+  p->hio.state = HOST_IO_DONE;
+  wakeup(&p->hio);
+}
+
+//
+// a transfer of a syscall of the current process: its first request to the host puts the
+// process to sleep until the host answers, and the hart runs other processes meanwhile.
+// the syscall runs again then, and the same transfer picks up the result. small reads, and
+// the transfers that may not sleep (the chunks after the first one), are served right away.
+//
+static ssize_t host_user_io(kfile *f, void *buf, size_t n, uint64 off, int write,
+                            int may_sleep) {
+  spike_file_t *sf = (spike_file_t *)f->priv;
+  if (!write && n < FILE_DIRECT_READ_MIN) return pcache_pread(sf, buf, n, off);
+
+  host_io *io = &current->hio;
+  if (io->state == HOST_IO_DONE) {
+    io->state = HOST_IO_IDLE;
+    // the syscall runs again with the same arguments. (the offset is not compared, an
+    // O_APPEND write moves it itself.)
+    if (io->f == f && io->buf == buf && io->n == n && io->write == write) {
+      if (write && io->ret > 0) pcache_invalidate(sf);
+      return io->ret;
+    }
+  }
+  if (io->state == HOST_IO_PENDING) {
+    // woken up before the answer: sleep on. the answer may come in between.
+    sleep_retry(io);
+    if (io->state == HOST_IO_DONE) wakeup(io);
+    return -EINPROGRESS;
+  }
+  if (!may_sleep) return write ? host_write(f, buf, n, off) : host_read(f, buf, n, off);
+
+  io->f = f;
+  io->buf = buf;
+  io->n = n;
+  io->write = write;
+  io->state = HOST_IO_PENDING;
+  // asleep before the request is out, so that an early answer wakes the process up.
+  // sleep_retry() is defined in kernel/sched.c
+  sleep_retry(io);
+  if (htif_submit(write ? HTIFSYS_pwrite : HTIFSYS_pread, sf->kfd, (uint64)buf, n, off, 0, 0,
+                  0, host_io_done, current) < 0) {
+    // all the request slots are taken: try again when the process runs next.
+    io->state = HOST_IO_IDLE;
+    wakeup(io);
+  }
+  return -EINPROGRESS;
+}
+
+static int host_stat(kfile *f, struct file_stat *st) {
+  spike_file_t *sf = (spike_file_t *)f->priv;
+  struct frontend_stat fs;
+  long r = frontend_syscall(HTIFSYS_fstat, sf->kfd, (uint64)&fs, 0, 0, 0, 0, 0);
+  if (r < 0) return r;
+
+  st->dev = fs.dev;
+  st->ino = fs.ino;
+  st->mode = fs.mode;
+  st->nlink = fs.nlink;
+  st->size = fs.size;
+  st->blksize = fs.blksize;
+  st->blocks = fs.blocks;
+  st->atime = fs.atime;
+  st->mtime = fs.mtime;
+  st->ctime = fs.ctime;
+  return 0;
+}
+
+static void host_prefetch(kfile *f, uint64 off, uint64 len) {
+  pcache_prefetch((spike_file_t *)f->priv, off, len);
+}
+
+static void host_release(kfile *f) { spike_file_decref((spike_file_t *)f->priv); }
+
+static const kfile_ops host_file_ops = {.read = host_read,
+                                        .write = host_write,
+                                        .stat = host_stat,
+                                        .prefetch = host_prefetch,
+                                        .user_io = host_user_io,
+                                        .release = host_release};
+
+/* --- files of the initramfs --- */
+
+static ssize_t ramfs_read(kfile *f, void *buf, size_t n, uint64 off) {
+  ramfs_node *node = (ramfs_node *)f->priv;
+  if (off >= node->size) return 0;
+  n = MIN(n, node->size - off);
+  memcpy(buf, node->data + off, n);
+  return n;
+}
+
+static ssize_t ramfs_write(kfile *f, const void *buf, size_t n, uint64 off) { return -1; }
+
+static int ramfs_stat(kfile *f, struct file_stat *st) {
+  ramfs_node *node = (ramfs_node *)f->priv;
+  memset(st, 0, sizeof(*st));
+  st->dev = RAMFS_DEV;
+  st->ino = node->ino;
+  st->mode = node->mode;
+  st->nlink = 1;
+  st->size = node->size;
+  st->blksize = PGSIZE;
+  st->blocks = ROUNDUP(node->size, 512) / 512;
+  st->atime = st->mtime = st->ctime = node->mtime;
+  return 0;
+}
+
+// the data is in memory already: no prefetch, and nothing to release.
+static const kfile_ops ramfs_file_ops = {
+    .read = ramfs_read, .write = ramfs_write, .stat = ramfs_stat, .release = NULL};
+
+/* --- the console --- */
+
+//
+// return the buffered characters of console input (see the console ring in
+// spike_interface/spike_htif.c), at most n. returns -EAGAIN if none has arrived: the
+// caller sleeps on the file, and file_console_poll() wakes it up.
+//
+static ssize_t console_read(kfile *f, void *buf, size_t n, uint64 off) {
+  if (n == 0) return 0;
+  size_t r = htif_console_read(buf, n);
+  return r ? r : -EAGAIN;
+}
+
+static ssize_t console_write(kfile *f, const void *buf, size_t n, uint64 off) {
+  // kernel messages still in the log ring come first, so the console keeps the order.
+  klog_flush();
+  return spike_file_write((spike_file_t *)f->priv, buf, n);
+}
+
+static int console_stat(kfile *f, struct file_stat *st) {
+  memset(st, 0, sizeof(*st));
+  st->mode = 0020000;  // a character device
+  st->nlink = 1;
+  return 0;
+}
+
+static const kfile_ops console_ops = {
+    .read = console_read, .write = console_write, .stat = console_stat, .release = NULL};
+
+// the console files behind descriptors 0, 1 and 2. they are never released.
+static kfile console_files[3] = {
+    {1, O_RDONLY, 0, 0, &console_ops, stdin},
+    {1, O_WRONLY, 0, 0, &console_ops, stdout},
+    {1, O_WRONLY, 0, 0, &console_ops, stderr},
+};
+
+void file_init(void) {
+  kfile_cache = kmem_cache_create("kfile", sizeof(kfile), 0, NULL);
+  // console input typed from now on is buffered until it is read.
+  htif_console_enable();
+}
+
+//
+// the console file of descriptor fd (0, 1 or 2), with a new reference.
+//
+kfile *file_console(int fd) {
+  kfile *f = &console_files[fd];
+  file_get(f);
+  return f;
+}
+
+//
+// open the file at path, in the initramfs if it is there, or else on the host. returns the
+// file with one reference, or NULL.
+//
+kfile *file_open(const char *path, int flags, int mode) {
+  ramfs_node *node = ramfs_lookup(path);
+  // the files of the initramfs are read-only.
+  if (node && (flags & (O_ACCMODE | O_CREAT | O_TRUNC | O_APPEND)) != O_RDONLY) return NULL;
+
+  kfile *f = (kfile *)kmem_cache_alloc(kfile_cache);
+  if (f == NULL) return NULL;
+
+  if (node) {
+    f->refcnt = 1;
+    f->flags = O_RDONLY;
+    f->seekable = 1;
+    f->pos = 0;
+    f->ops = &ramfs_file_ops;
+    f->priv = node;
+    return f;
+  }
+
+  spike_file_t *sf = spike_file_open(path, flags, mode);
+  if (IS_ERR_VALUE(sf)) {
+    kmem_cache_free(kfile_cache, f);
+    return NULL;
+  }
+  // spike_file_open() returns the file with an extra reference (of a host fd table that
+  // PKE does not use). drop it, the kfile holds the only one.
+  spike_file_decref(sf);
+
+  f->refcnt = 1;
+  f->flags = flags & (O_ACCMODE | O_APPEND);
+  f->seekable = 1;
+  f->pos = 0;
+  f->ops = &host_file_ops;
+  f->priv = sf;
+  return f;
+}
+
+//
+// service the HTIF, and wake the processes waiting for console input if some has arrived.
+// called at every timer tick.
+//
+void file_console_poll(void) {
+  htif_poll();
+  if (htif_console_avail()) wakeup(&console_files[0]);
+}
+
+void file_get(kfile *f) { atomic_add(&f->refcnt, 1); }
+
+//
+// drop a reference of f, releasing it with the last one.
+//
+void file_put(kfile *f) {
+  if (atomic_add(&f->refcnt, -1) != 1) return;
+  if (f->ops->release) f->ops->release(f);
+  kmem_cache_free(kfile_cache, f);
+}
@@ -0,0 +1,57 @@
+#ifndef _FILE_H_
+#define _FILE_H_
+
+#include "util/types.h"
+#include "syscall.h"
+#include "spike_interface/spike_file.h"
+
+struct kfile_t;
+
+// operations of a kind of file. buf is a kernel (i.e., physical) address. off is ignored
+// by files that are not seekable. a read that would have to wait returns -EAGAIN.
+typedef struct kfile_ops_t {
+  ssize_t (*read)(struct kfile_t *f, void *buf, size_t n, uint64 off);
+  ssize_t (*write)(struct kfile_t *f, const void *buf, size_t n, uint64 off);
+  int (*stat)(struct kfile_t *f, struct file_stat *st);
+  // optional: bring [off, off+len) close (e.g., into the page cache) before it is read
+  void (*prefetch)(struct kfile_t *f, uint64 off, uint64 len);
+  // optional: a transfer of a syscall of the current process, which puts the process to
+  // sleep while the object works, if may_sleep is set. returns the result, -EINPROGRESS
+  // if the process sleeps (the syscall runs again once it is woken up, and gets the
+  // result then). without may_sleep, the transfer waits for the object in place.
+  ssize_t (*user_io)(struct kfile_t *f, void *buf, size_t n, uint64 off, int write,
+                     int may_sleep);
+  // called when the last reference is dropped
+  void (*release)(struct kfile_t *f);
+} kfile_ops;
+
+// an open file, shared by the descriptors that dup() makes of it.
+typedef struct kfile_t {
+  int refcnt;
+  int flags;     // O_RDONLY, O_WRONLY or O_RDWR, and O_APPEND
+  int seekable;  // does the file have a position (and support pread)?
+  uint64 pos;    // position of read() and write()
+  const kfile_ops *ops;
+  void *priv;    // the object behind the file, e.g., a spike_file_t or a ramfs_node
+} kfile;
+
+// the host request a process sleeps on (see host_user_io() in kernel/file.c): the
+// transfer it serves, and its result once the host has answered.
+enum { HOST_IO_IDLE = 0, HOST_IO_PENDING, HOST_IO_DONE };
+typedef struct host_io_t {
+  volatile int state;
+  long ret;
+  struct kfile_t *f;
+  void *buf;
+  size_t n;
+  int write;
+} host_io;
+
+void file_init(void);
+kfile *file_open(const char *path, int flags, int mode);
+kfile *file_console(int fd);
+void file_get(kfile *f);
+void file_put(kfile *f);
+void file_console_poll(void);
+
+#endif
@@ -6,46 +6,122 @@
 #include "string.h"
 #include "elf.h"
 #include "process.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "memlayout.h"
+#include "vma.h"
+#include "pcache.h"
+#include "file.h"
+#include "sched.h"
 
 #include "spike_interface/spike_utils.h"
+#include "spike_interface/atomic.h"
 
-// process is a structure defined in kernel/process.h
-process user_app;
+//
+// turn on paging with the kernel page table. the kernel direct-maps the DRAM, so the
+// code keeps running at the same addresses after the switch.
+//
+void enable_paging() {
+  // write the pointer to kernel page (table) directory into the CSR of "satp".
+  write_csr(satp, MAKE_SATP(g_kernel_pagetable));
+
+  // refresh tlb to invalidate its content.
+  flush_tlb();
+}
 
 //
-// load the elf, and construct a "process" (with only a trapframe).
+// load the elf at path, and construct a "process" (with only a trapframe).
 // load_bincode_from_host_elf is defined in elf.c
 //
-void load_user_program(process *proc) {
-  // USER_TRAP_FRAME is a physical address defined in kernel/config.h
-  proc->trapframe = (trapframe *)USER_TRAP_FRAME;
-  memset(proc->trapframe, 0, sizeof(trapframe));
-  // USER_KSTACK is also a physical address defined in kernel/config.h
-  proc->kstack = USER_KSTACK;
-  proc->trapframe->regs.sp = USER_STACK;
+process* load_user_program(const char* path) {
+  // alloc_process() is defined in kernel/process.c
+  process* proc = alloc_process();
+  if (proc == NULL) panic("load_user_program: out of processes or memory.\n");
+  sprint("User application is loading.\n");
 
   // load_bincode_from_host_elf() is defined in kernel/elf.c
-  load_bincode_from_host_elf(proc);
+  if (load_bincode_from_host_elf(proc, path) != 0) panic("Fail to load %s.\n", path);
+  return proc;
+}
+
+// set by the boot hart once the kernel is initialized. the other harts wait for it in
+// s_start_secondary().
+static volatile int kernel_ready = 0;
+
+//
+// enable the interrupts S mode takes: the timer ticks forwarded by M mode (see
+// kernel/machine/mtrap.c), which drive the preemption of processes, and the IPIs of the
+// scheduler. they arrive while user code runs, or wake an idle hart.
+//
+static void enable_sinterrupts(void) {
+  // let the applications read the time and the counters as well.
+  write_csr(scounteren, -1);
+  write_csr(sie, read_csr(sie) | SIE_STIE | SIE_SSIE);
+}
+
+//
+// the S-mode entry of the harts other than hart 0. they join the scheduler once the boot
+// hart has set up the kernel.
+//
+static void s_start_secondary(void) {
+  while (!kernel_ready)
+    ;
+  mb();
+
+  enable_paging();
+  enable_sinterrupts();
+  sprint("hart %d joins the scheduler.\n", cpuid());
+  sched_join();
+  schedule();
 }
 
 //
 // s_start: S-mode entry point of riscv-pke OS kernel.
 //
 int s_start(void) {
+  if (cpuid() != 0) s_start_secondary();
+
   sprint("Enter supervisor mode...\n");
-  // Note: we use direct (i.e., Bare mode) for memory mapping in lab1.
-  // which means: Virtual Address = Physical Address
-  // therefore, we need to set satp to be 0 for now. we will enable paging in lab2_x.
-  // 
-  // write_csr is a macro defined in kernel/riscv.h
+  // in the beginning, we use Bare mode (direct) memory mapping as in lab1.
+  // but now, we are going to switch to the paging mode @lab2_1.
+  // note, the code still works in Bare mode when calling pmm_init() and kern_vm_init().
   write_csr(satp, 0);
 
-  // the application code (elf) is first loaded into memory, and then put into execution
-  load_user_program(&user_app);
+  // init the buddy page allocator. pmm_init() is defined in kernel/pmm.c
+  pmm_init();
+
+  // build the kernel page table (a megapage direct map of the DRAM), and switch to it.
+  // kern_vm_init() is defined in kernel/vmm.c
+  kern_vm_init();
+  enable_paging();
+  sprint("kernel page table is on \n");
+
+  // the process table and the caches of trapframes and VMAs. init_proc_pool() is
+  // defined in kernel/process.c, and vma_init() in kernel/vma.c
+  init_proc_pool();
+  vma_init();
+  // the page cache of host files, defined in kernel/pcache.c
+  pcache_init();
+  // the cache of open files, defined in kernel/file.c
+  file_init();
+
+  // every application on the command line is loaded into a process of its own, and
+  // queued for the scheduler. get_cmdline_apps() is defined in kernel/elf.c
+  char** apps;
+  size_t napps = get_cmdline_apps(&apps);
+  if (!napps) panic("You need to specify the application program!\n");
+  for (size_t i = 0; i < napps; i++) insert_to_ready_queue(load_user_program(apps[i]));
+
+  enable_sinterrupts();
+  sched_join();
+  // the other harts may start now.
+  mb();
+  kernel_ready = 1;
 
   sprint("Switch to user mode...\n");
-  // switch_to() is defined in kernel/process.c
-  switch_to(&user_app);
+  // schedule() is defined in kernel/sched.c. it switches to the first process, and never
+  // returns.
+  schedule();
 
   // we should never reach here.
   return 0;
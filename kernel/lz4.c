@@ -0,0 +1,65 @@
+/*
+ * decompressor of LZ4 blocks, used to load packed application images (see kernel/elf.c
+ * and tools/elf_pack.c).
+ *
+ * a block is a sequence of sequences. each starts with a token byte: the high nibble is
+ * the number of literals, the low nibble the match length minus 4 (15 in either means
+ * that more length bytes follow, each adding up to 255). the literals are followed by a
+ * 2-byte little endian offset back into the output, from where the match is copied. the
+ * last sequence has literals only.
+ */
+
+#include "lz4.h"
+
+#define LZ4_MIN_MATCH 4
+
+//
+// read an extended length: bytes are added until one is below 255.
+//
+static int lz4_read_length(const uint8 **ip, const uint8 *iend, uint64 *len) {
+  uint8 b;
+  do {
+    if (*ip >= iend) return -1;
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return 0;
+}
+
+int64 lz4_decompress(const uint8 *src, uint64 src_len, uint8 *dst, uint64 dst_cap) {
+  const uint8 *ip = src, *iend = src + src_len;
+  uint8 *op = dst, *oend = dst + dst_cap;
+
+  while (ip < iend) {
+    uint8 token = *ip++;
+
+    // literals
+    uint64 len = token >> 4;
+    if (len == 15 && lz4_read_length(&ip, iend, &len) != 0) return -1;
+    if (len > (uint64)(iend - ip) || len > (uint64)(oend - op)) return -1;
+    for (uint64 i = 0; i < len; i++) op[i] = ip[i];
+    ip += len;
+    op += len;
+
+    // the last sequence ends after its literals.
+    if (ip == iend) break;
+
+    // match
+    if (iend - ip < 2) return -1;
+    uint64 offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (uint64)(op - dst)) return -1;
+
+    len = token & 15;
+    if (len == 15 && lz4_read_length(&ip, iend, &len) != 0) return -1;
+    len += LZ4_MIN_MATCH;
+    if (len > (uint64)(oend - op)) return -1;
+
+    // the ranges may overlap (offset < len), which repeats the last offset bytes.
+    const uint8 *match = op - offset;
+    for (uint64 i = 0; i < len; i++) op[i] = match[i];
+    op += len;
+  }
+
+  return op - dst;
+}
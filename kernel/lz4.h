@@ -0,0 +1,10 @@
+#ifndef _LZ4_H_
+#define _LZ4_H_
+
+#include "util/types.h"
+
+// decompress the LZ4 block (raw block format, no frame) of src_len bytes at src into dst,
+// which holds dst_cap bytes. returns the decompressed size, or -1 for a malformed block.
+int64 lz4_decompress(const uint8 *src, uint64 src_len, uint8 *dst, uint64 dst_cap);
+
+#endif
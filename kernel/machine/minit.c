@@ -6,25 +6,40 @@
 #include "kernel/riscv.h"
 #include "kernel/config.h"
 #include "spike_interface/spike_utils.h"
+#include "spike_interface/atomic.h"
+#include "mtrap.h"
 
 //
 // global variables are placed in the .data section.
 // stack0 is the privilege mode stack(s) of the proxy kernel on CPU(s)
 // allocates 4KB stack space for each processor (hart)
 //
-// NCPU is defined to be 1 in kernel/config.h, as we consider only one HART in basic
-// labs.
+// NCPU is defined in kernel/config.h, _mentry parks the harts beyond it.
 //
 __attribute__((aligned(16))) char stack0[4096 * NCPU];
 
+// mstack is the stack of the M-mode trap handler (kernel/machine/mtrap_vector.S), 4KB per
+// hart. stack0 cannot serve for it: S mode keeps running on stack0 after the mret of
+// m_start(), until the hart enters the scheduler, and the timer and IPI traps arrive
+// meanwhile.
+__attribute__((aligned(16))) char mstack[4096 * NCPU];
+
 // sstart() is the supervisor state entry point defined in kernel/kernel.c
 extern void s_start();
+// the M-mode trap vector and the interrupt frames, defined in kernel/machine/mtrap_vector.S
+// and kernel/machine/mtrap.c
+extern void mtrapvec();
+extern riscv_regs g_itrframe[];
 
 // htif is defined in spike_interface/spike_htif.c, marks the availability of HTIF
 extern uint64 htif;
 // g_mem_size is defined in spike_interface/spike_memory.c, size of the emulated memory
 extern uint64 g_mem_size;
 
+// set by the boot hart (hart 0) once the HTIF and the memory are known. the other harts
+// wait for it in m_start().
+static volatile int m_boot_done = 0;
+
 //
 // get the information of HTIF (calling interface) and the emulated memory by
 // parsing the Device Tree Blog (DTB, actually DTS) stored in memory.
@@ -36,11 +51,11 @@ extern uint64 g_mem_size;
 void init_dtb(uint64 dtb) {
   // defined in spike_interface/spike_htif.c, enabling Host-Target InterFace (HTIF)
   query_htif(dtb);
-  if (htif) sprint("HTIF is available!\r\n");
+  if (htif) printm("HTIF is available!\r\n");
 
   // defined in spike_interface/spike_memory.c, obtain information about emulated memory
   query_mem(dtb);
-  sprint("(Emulated) memory size: %ld MB\n", g_mem_size >> 20);
+  printm("(Emulated) memory size: %ld MB\n", g_mem_size >> 20);
 }
 
 //
@@ -75,15 +90,33 @@ static void delegate_traps() {
 // m_start: machine mode C entry point.
 //
 void m_start(uintptr_t hartid, uintptr_t dtb) {
-  // init the spike file interface (stdin,stdout,stderr)
-  // functions with "spike_" prefix are all defined in codes under spike_interface/,
-  // sprint is also defined in spike_interface/spike_utils.c
-  spike_file_init();
-  sprint("In m_start, hartid:%d\n", hartid);
+  // keep the hart id in tp, where the kernel (and the per-hart log rings) find it (see
+  // cpuid() in kernel/riscv.h). write_tp is defined in kernel/riscv.h
+  write_tp(hartid);
+
+  if (hartid == 0) {
+    // init the spike file interface (stdin,stdout,stderr)
+    // functions with "spike_" prefix are all defined in codes under spike_interface/,
+    // sprint is also defined in spike_interface/spike_utils.c
+    spike_file_init();
+    // printm is defined in spike_interface/spike_utils.c, one host round trip per message.
+    printm("In m_start, hartid:%d\n", hartid);
 
-  // init HTIF (Host-Target InterFace) and memory by using the Device Table Blob (DTB)
-  // init_dtb() is defined above.
-  init_dtb(dtb);
+    // init HTIF (Host-Target InterFace) and memory by using the Device Table Blob (DTB)
+    // init_dtb() is defined above.
+    init_dtb(dtb);
+    mb();
+    m_boot_done = 1;
+  } else {
+    // the other harts share what the boot hart has found.
+    while (!m_boot_done)
+      ;
+    mb();
+    printm("In m_start, hartid:%d\n", hartid);
+  }
+
+  // let S mode read the time and the counters, e.g., for the time stamps of the log.
+  write_csr(mcounteren, -1);
 
   // set previous privilege mode to S (Supervisor), and will enter S mode after 'mret'
   // write_csr is a macro defined in kernel/riscv.h
@@ -96,6 +129,13 @@ void m_start(uintptr_t hartid, uintptr_t dtb) {
   // delegate_traps() is defined above.
   delegate_traps();
 
+  // the traps left to M mode (the timer interrupt, and ecalls of the kernel) go to
+  // mtrapvec, which saves the registers of the interrupted code in g_itrframe.
+  write_csr(mscratch, (uint64)&g_itrframe[hartid]);
+  write_csr(mtvec, (uint64)mtrapvec);
+  // start the timer ticks of the hart. timer_init() is defined in kernel/machine/mtrap.c
+  timer_init(hartid);
+
   // switch to supervisor mode (S mode) and jump to s_start(), i.e., set pc to mepc
   asm volatile("mret");
 }
@@ -0,0 +1,96 @@
+/*
+ * M-mode trap handling.
+ *
+ * the timer interrupt of the CLINT can only be taken in M mode. every TIMER_INTERVAL
+ * ticks of mtime, the handler below programs the next deadline in mtimecmp and forwards
+ * the interrupt to S mode by raising STIP, which S mode cannot clear by itself: the
+ * kernel acknowledges each tick with an ecall (MCALL_TIMER_ACK).
+ *
+ * IPIs take the same path: the sender asks M mode to raise the software interrupt of the
+ * target hart in the CLINT (MCALL_SEND_IPI), and M mode on the target forwards it as a
+ * supervisor software interrupt, which S mode clears by itself.
+ */
+
+#include "mtrap.h"
+#include "kernel/riscv.h"
+#include "kernel/config.h"
+#include "kernel/memlayout.h"
+#include "spike_interface/spike_utils.h"
+
+// the interrupt frames of the harts, where mtrapvec (kernel/machine/mtrap_vector.S) saves
+// the registers of the interrupted code.
+riscv_regs g_itrframe[NCPU];
+
+//
+// set the first deadline of the timer of hartid, and enable the M-mode timer and software
+// (IPI) interrupts.
+//
+void timer_init(uint64 hartid) {
+  *(volatile uint64 *)CLINT_MTIMECMP(hartid) = *(volatile uint64 *)CLINT_MTIME + TIMER_INTERVAL;
+  write_csr(mie, read_csr(mie) | MIE_MTIE | MIE_MSIE);
+}
+
+//
+// the timer interrupt: program the next deadline, and pass the tick on to S mode.
+//
+static void handle_timer(void) {
+  uint64 hartid = read_csr(mhartid);
+  // counted from now rather than from the last deadline, so that ticks do not pile up
+  // when the emulation falls behind.
+  *(volatile uint64 *)CLINT_MTIMECMP(hartid) = *(volatile uint64 *)CLINT_MTIME + TIMER_INTERVAL;
+  write_csr(mip, read_csr(mip) | MIP_STIP);
+}
+
+//
+// an IPI: pass it on to S mode.
+//
+static void handle_soft(void) {
+  *(volatile uint32 *)CLINT_MSIP(read_csr(mhartid)) = 0;
+  write_csr(mip, read_csr(mip) | MIP_SSIP);
+}
+
+//
+// an ecall from S mode: serve the request in a7, and skip the ecall.
+//
+static void handle_mcall(riscv_regs *regs) {
+  switch (regs->a7) {
+    case MCALL_TIMER_ACK:
+      write_csr(mip, read_csr(mip) & ~MIP_STIP);
+      regs->a0 = 0;
+      break;
+    case MCALL_SEND_IPI:
+      if (regs->a0 < NCPU) {
+        *(volatile uint32 *)CLINT_MSIP(regs->a0) = 1;
+        regs->a0 = 0;
+      } else {
+        regs->a0 = -1;
+      }
+      break;
+    default:
+      regs->a0 = -1;
+      break;
+  }
+  write_csr(mepc, read_csr(mepc) + 4);
+}
+
+//
+// called by mtrapvec with the interrupt frame of the hart.
+//
+void handle_mtrap(riscv_regs *regs) {
+  uint64 mcause = read_csr(mcause);
+  switch (mcause) {
+    case CAUSE_MTIMER:
+      handle_timer();
+      break;
+    case CAUSE_MSOFT:
+      handle_soft();
+      break;
+    case CAUSE_SUPERVISOR_ECALL:
+      handle_mcall(regs);
+      break;
+    default:
+      printm("machine trap: mcause %p mepc %p mtval %p\n", mcause, read_csr(mepc),
+             read_csr(mtval));
+      poweroff(-1);
+  }
+}
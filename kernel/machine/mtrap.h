@@ -0,0 +1,22 @@
+#ifndef _MTRAP_H_
+#define _MTRAP_H_
+
+#include "util/types.h"
+
+// services that the S-mode kernel requests from M mode with an ecall: the service number
+// goes in a7, and the result comes back in a0 (see handle_mcall() in kernel/machine/mtrap.c).
+// MCALL_TIMER_ACK clears the pending supervisor timer interrupt of the calling hart.
+// MCALL_SEND_IPI raises a supervisor software interrupt on the hart in a0.
+#define MCALL_TIMER_ACK 1
+#define MCALL_SEND_IPI 2
+
+static inline long mcall(long which, long arg) {
+  register long a0 asm("a0") = arg;
+  register long a7 asm("a7") = which;
+  asm volatile("ecall" : "+r"(a0) : "r"(a7) : "memory");
+  return a0;
+}
+
+void timer_init(uint64 hartid);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _MEMLAYOUT_H
+#define _MEMLAYOUT_H
+
+#include "riscv.h"
+
+// start virtual address (4KB aligned) of kernel. the kernel direct-maps the whole DRAM
+// from here, i.e., kernel virtual address = physical address.
+#define KERN_BASE 0x80000000
+
+// user space occupies [0, USER_SPACE_TOP), below the kernel.
+#define USER_SPACE_TOP KERN_BASE
+
+// the top of the user stack (virtual address)
+#define USER_STACK_TOP 0x7ffff000
+
+// the CLINT (core local interruptor) of spike, accessed by M mode only.
+#define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4 * (hartid))
+#define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8 * (hartid))
+#define CLINT_MTIME (CLINT + 0xBFF8)  // cycles since boot
+
+#endif
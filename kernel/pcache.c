@@ -0,0 +1,345 @@
+/*
+ * the page cache of host files.
+ *
+ * reads of host files (ELF headers, demand-paged segments, file syscalls) go through this
+ * cache instead of straight to the host. a cached page is identified by the host file
+ * (device, inode and modification time, from HTIFSYS_fstat) and its page index, so the
+ * pages of an application stay cached across loads and are shared by every process that
+ * reads the same file. a write to a host file drops all its cached pages.
+ *
+ * the number of cached pages is bounded by PCACHE_MEM_PERCENT of the emulated memory, and
+ * the least recently used page is evicted first. a miss that continues a sequential scan
+ * reads ahead with a window that doubles up to 2^PCACHE_RA_MAX_ORDER pages, filled by one
+ * host request into a block from the buddy allocator. the lock of the cache is not held
+ * while the host works, so a miss of one hart does not stall the others.
+ */
+
+#include "pcache.h"
+#include "pmm.h"
+#include "slab.h"
+#include "riscv.h"
+#include "config.h"
+#include "string.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+// g_mem_size is defined in spike_interface/spike_memory.c, size of the emulated memory
+extern uint64 g_mem_size;
+
+typedef struct pcache_page_t {
+  // the key: host file and page index.
+  uint64 dev, ino, mtime, index;
+  // the cached bytes. only the first len bytes hold file data (len < PGSIZE at the end of
+  // the file), the rest is zeroed.
+  void *data;
+  uint32 len;
+  // the chain of the hash bucket, and the LRU list (most recently used first).
+  struct pcache_page_t *hnext;
+  struct pcache_page_t *lru_prev, *lru_next;
+} pcache_page;
+
+#define PCACHE_HASH_SIZE 512
+
+static pcache_page *pcache_hash[PCACHE_HASH_SIZE];
+// dummy head of the circular LRU list
+static pcache_page pcache_lru = {.lru_prev = &pcache_lru, .lru_next = &pcache_lru};
+static kmem_cache *pcache_page_cache;
+static spinlock_t pcache_lock = SPINLOCK_INIT;
+static pcache_stats stats;
+// bumped by pcache_invalidate(), so that a host read that was under way meanwhile does not
+// fill the cache with the old contents.
+static uint64 pcache_gen;
+
+void pcache_init(void) {
+  pcache_page_cache = kmem_cache_create("pcache_page", sizeof(pcache_page), 0, NULL);
+  stats.max_pages = g_mem_size / 100 * PCACHE_MEM_PERCENT / PGSIZE;
+}
+
+static inline uint64 pcache_bucket(uint64 ino, uint64 index) {
+  return ((ino * 0x9e3779b97f4a7c15UL) ^ (index * 0xc2b2ae3d27d4eb4fUL)) >> 32 &
+         (PCACHE_HASH_SIZE - 1);
+}
+
+//
+// fetch the identity of the host file f, once.
+//
+static int pcache_ident(spike_file_t *f) {
+  if (f->ident_valid) return 0;
+
+  struct frontend_stat st;
+  if (frontend_syscall(HTIFSYS_fstat, f->kfd, (uint64)&st, 0, 0, 0, 0, 0) < 0) return -1;
+  f->dev = st.dev;
+  f->ino = st.ino;
+  f->mtime = st.mtime;
+  f->size = st.size;
+  f->ident_valid = 1;
+  return 0;
+}
+
+static pcache_page *pcache_lookup(spike_file_t *f, uint64 index) {
+  for (pcache_page *pg = pcache_hash[pcache_bucket(f->ino, index)]; pg; pg = pg->hnext)
+    if (pg->index == index && pg->ino == f->ino && pg->dev == f->dev && pg->mtime == f->mtime)
+      return pg;
+  return NULL;
+}
+
+static void lru_unlink(pcache_page *pg) {
+  pg->lru_prev->lru_next = pg->lru_next;
+  pg->lru_next->lru_prev = pg->lru_prev;
+}
+
+static void lru_push(pcache_page *pg) {
+  pg->lru_next = pcache_lru.lru_next;
+  pg->lru_prev = &pcache_lru;
+  pcache_lru.lru_next->lru_prev = pg;
+  pcache_lru.lru_next = pg;
+}
+
+//
+// remove the page pg from the cache, and free it. link points to the link to pg in its
+// hash chain.
+//
+static void pcache_drop(pcache_page **link, pcache_page *pg) {
+  *link = pg->hnext;
+  lru_unlink(pg);
+
+  free_page(pg->data);
+  kmem_cache_free(pcache_page_cache, pg);
+  stats.pages--;
+}
+
+//
+// drop the least recently used page.
+//
+static void pcache_evict(void) {
+  pcache_page *pg = pcache_lru.lru_prev;
+  if (pg == &pcache_lru) return;
+
+  pcache_page **link = &pcache_hash[pcache_bucket(pg->ino, pg->index)];
+  while (*link != pg) link = &(*link)->hnext;
+  pcache_drop(link, pg);
+  stats.evictions++;
+}
+
+//
+// add the page at data (len bytes of file data) as page index of f. returns the cache entry,
+// or NULL (with data freed) if no descriptor could be allocated.
+//
+static pcache_page *pcache_insert(spike_file_t *f, uint64 index, void *data, uint32 len) {
+  pcache_page *pg = (pcache_page *)kmem_cache_alloc(pcache_page_cache);
+  if (pg == NULL) {
+    free_page(data);
+    return NULL;
+  }
+
+  pg->dev = f->dev;
+  pg->ino = f->ino;
+  pg->mtime = f->mtime;
+  pg->index = index;
+  pg->data = data;
+  pg->len = len;
+  memset(data + len, 0, PGSIZE - len);
+
+  uint64 b = pcache_bucket(f->ino, index);
+  pg->hnext = pcache_hash[b];
+  pcache_hash[b] = pg;
+  lru_push(pg);
+
+  stats.pages++;
+  while (stats.pages > stats.max_pages && pcache_lru.lru_prev != pg) pcache_evict();
+  return pg;
+}
+
+//
+// the number of pages (at most max) from page index of f on that are not cached.
+//
+static uint64 pcache_uncached_run(spike_file_t *f, uint64 index, uint64 max) {
+  uint64 last = ROUNDUP(f->size, PGSIZE) / PGSIZE;
+  if (index >= last) return 0;
+  max = MIN(max, last - index);
+
+  uint64 n = 0;
+  while (n < max && pcache_lookup(f, index + n) == NULL) n++;
+  return n;
+}
+
+//
+// read n (at most 2^PCACHE_RA_MAX_ORDER) pages of f from page index on into the cache,
+// with one host request into a block of the buddy allocator. returns the entry of page
+// index, or NULL beyond the end of the file, on errors, or if f was written meanwhile.
+//
+// called with pcache_lock held. the lock is released during the host request, so the
+// other harts keep using the cache; pages another hart has added meanwhile are kept.
+//
+static pcache_page *pcache_read_block(spike_file_t *f, uint64 index, uint64 n) {
+  int order = 0;
+  while ((1UL << order) < n) order++;
+  void *block = alloc_pages(order);
+  if (block == NULL) {
+    // no large block, read only the requested page.
+    n = 1;
+    order = 0;
+    if ((block = alloc_page()) == NULL) {
+      pcache_evict();
+      if ((block = alloc_page()) == NULL) return NULL;
+    }
+  }
+
+  uint64 gen = pcache_gen;
+  spinlock_unlock(&pcache_lock);
+  ssize_t r = spike_file_pread(f, block, n * PGSIZE, index * PGSIZE);
+  spinlock_lock(&pcache_lock);
+  stats.host_reads++;
+  if (r > 0) stats.host_bytes += r;
+  // the pages read may predate a write to the file.
+  if (pcache_gen != gen) r = 0;
+
+  pcache_page *first = NULL;
+  for (uint64 i = 0; i < (1UL << order); i++) {
+    void *data = block + i * PGSIZE;
+    pcache_page *pg = NULL;
+    if (i < n && r > 0 && i * PGSIZE < r) {
+      // another hart may have read the page meanwhile.
+      if ((pg = pcache_lookup(f, index + i)) != NULL)
+        free_page(data);
+      else if ((pg = pcache_insert(f, index + i, data, MIN(PGSIZE, r - i * PGSIZE))) && i > 0)
+        stats.readahead++;
+    } else {
+      // the buddy allocator takes back the pages of a block one by one.
+      free_page(data);
+    }
+    if (i == 0) first = pg;
+  }
+
+  return first;
+}
+
+//
+// read page index of f (and the read-ahead pages after it) from the host into the cache.
+// returns the entry of page index, or NULL beyond the end of the file or on errors.
+//
+static pcache_page *pcache_fill(spike_file_t *f, uint64 index) {
+  // a miss right where the last read ended continues a sequential scan.
+  uint64 n = 1;
+  if (index == f->ra_next && f->ra_pages) n = MIN(f->ra_pages * 2, 1UL << PCACHE_RA_MAX_ORDER);
+  if ((n = pcache_uncached_run(f, index, n)) == 0) return NULL;
+
+  f->ra_next = index + n;
+  f->ra_pages = n;
+  return pcache_read_block(f, index, n);
+}
+
+//
+// bring the bytes [off, off+len) of f into the cache, with as few host requests as the
+// read-ahead block size allows. pages that are cached already are not read again.
+// returns the number of host requests issued, or -1.
+//
+int pcache_prefetch(spike_file_t *f, uint64 off, uint64 len) {
+  if (len == 0) return 0;
+  if (pcache_ident(f) != 0) return -1;
+
+  int reqs = 0;
+  spinlock_lock(&pcache_lock);
+  uint64 index = off / PGSIZE, end = ROUNDUP(off + len, PGSIZE) / PGSIZE;
+  while (index < end) {
+    if (pcache_lookup(f, index)) {
+      index++;
+      continue;
+    }
+    uint64 n = pcache_uncached_run(f, index, MIN(end - index, 1UL << PCACHE_RA_MAX_ORDER));
+    if (n == 0 || pcache_read_block(f, index, n) == NULL) break;
+    reqs++;
+    index += n;
+  }
+  spinlock_unlock(&pcache_lock);
+  return reqs;
+}
+
+//
+// forget the cached pages of the host file f, after it has been written. all of them are
+// dropped, whatever their mtime: a write within the second of the last one leaves the
+// mtime as it was, and a write past the end changes the short page at the old end.
+//
+void pcache_invalidate(spike_file_t *f) {
+  // the pages are found by the device and inode of f.
+  if (pcache_ident(f) != 0) return;
+
+  spinlock_lock(&pcache_lock);
+  for (int b = 0; b < PCACHE_HASH_SIZE; b++) {
+    pcache_page **link = &pcache_hash[b];
+    while (*link) {
+      pcache_page *pg = *link;
+      if (pg->ino == f->ino && pg->dev == f->dev)
+        pcache_drop(link, pg);
+      else
+        link = &pg->hnext;
+    }
+  }
+  // the size (and mtime) are fetched again by the next read.
+  f->ident_valid = 0;
+  pcache_gen++;
+  f->ra_pages = 0;
+  spinlock_unlock(&pcache_lock);
+}
+
+//
+// read n bytes of the host file f from offset off into buf, through the page cache.
+// returns the number of bytes read (less than n at the end of the file), or -1.
+//
+ssize_t pcache_pread(spike_file_t *f, void *buf, size_t n, uint64 off) {
+  if (pcache_ident(f) != 0) return spike_file_pread(f, buf, n, off);
+
+  spinlock_lock(&pcache_lock);
+  size_t done = 0;
+  int direct = 0;
+  while (done < n) {
+    uint64 index = (off + done) / PGSIZE, pgoff = (off + done) % PGSIZE;
+
+    pcache_page *pg = pcache_lookup(f, index);
+    if (pg) {
+      stats.hits++;
+      lru_unlink(pg);
+      lru_push(pg);
+    } else {
+      stats.misses++;
+      uint64 gen = pcache_gen;
+      if ((pg = pcache_fill(f, index)) == NULL) {
+        // the file was written during the fill: the rest is read past the cache.
+        direct = pcache_gen != gen;
+        break;
+      }
+    }
+
+    if (pgoff >= pg->len) break;
+    size_t len = MIN(n - done, pg->len - pgoff);
+    memcpy(buf + done, pg->data + pgoff, len);
+    done += len;
+    // a short page is the last one of the file.
+    if (pg->len < PGSIZE) break;
+  }
+  spinlock_unlock(&pcache_lock);
+
+  if (direct) {
+    ssize_t r = spike_file_pread(f, buf + done, n - done, off + done);
+    if (r < 0) return done ? done : r;
+    done += r;
+  }
+  return done;
+}
+
+void pcache_get_stats(pcache_stats *st) {
+  spinlock_lock(&pcache_lock);
+  *st = stats;
+  spinlock_unlock(&pcache_lock);
+}
+
+//
+// print the counters of the page cache.
+//
+void pcache_dump(void) {
+  pcache_stats st;
+  pcache_get_stats(&st);
+  sprint("page cache: %ld/%ld pages, %ld hits, %ld misses, %ld host reads (%ld bytes), "
+         "%ld read ahead, %ld evicted\n", st.pages, st.max_pages, st.hits, st.misses,
+         st.host_reads, st.host_bytes, st.readahead, st.evictions);
+}
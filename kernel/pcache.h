@@ -0,0 +1,24 @@
+#ifndef _PCACHE_H_
+#define _PCACHE_H_
+
+#include "util/types.h"
+#include "spike_interface/spike_file.h"
+
+// counters of the page cache.
+typedef struct pcache_stats_t {
+  uint64 hits, misses;     // pages found / not found in the cache
+  uint64 host_reads;       // preads issued to the host
+  uint64 host_bytes;       // bytes returned by them
+  uint64 readahead;        // pages read beyond the requested ones
+  uint64 evictions;        // pages dropped by the LRU policy
+  uint64 pages, max_pages; // pages cached now, and the limit
+} pcache_stats;
+
+void pcache_init(void);
+ssize_t pcache_pread(spike_file_t *f, void *buf, size_t n, uint64 off);
+int pcache_prefetch(spike_file_t *f, uint64 off, uint64 len);
+void pcache_invalidate(spike_file_t *f);
+void pcache_get_stats(pcache_stats *st);
+void pcache_dump(void);
+
+#endif
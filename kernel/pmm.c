@@ -0,0 +1,190 @@
+/*
+ * Buddy-system physical page allocator.
+ *
+ * every page between the end of PKE kernel (_end) and the end of the emulated DRAM
+ * (DRAM_BASE + g_mem_size) is managed as part of a block of 2^order pages. a free block
+ * of a given order sits in the free list of that order. allocation splits a larger block
+ * when necessary, and freeing merges a block with its buddy as long as the buddy is free,
+ * so both take O(log n) steps.
+ *
+ * block positions are counted in pages from the first managed page, and the buddy of the
+ * block starting at index i of order k starts at index (i ^ 2^k).
+ */
+
+#include "pmm.h"
+#include "riscv.h"
+#include "config.h"
+#include "string.h"
+#include "util/functions.h"
+#include "spike_interface/atomic.h"
+#include "spike_interface/spike_utils.h"
+
+// _end is defined in kernel/kernel.lds, it marks the ending address of PKE kernel.
+extern char _end[];
+// g_mem_size is defined in spike_interface/spike_memory.c, it indicates the size of the
+// (emulated) DRAM of our spike machine, and is obtained when parsing the DTB.
+extern uint64 g_mem_size;
+
+static uint64 free_mem_start_addr;  // beginning address of the managed pages
+static uint64 free_mem_end_addr;    // end address of the managed pages (not included)
+
+// descriptors of the managed pages, stored right after the kernel image.
+static page *g_pages;
+static uint64 g_npages;
+
+// free lists, one circular list (with a dummy head) for each order.
+static page free_area[PMM_MAX_ORDER];
+static uint64 nr_free_pages;
+
+// the allocator is shared by all harts. each hart waits for it on a queue node of its own
+// (the kernel is not preemptive, so a hart takes the lock once at a time).
+static mcs_lock_t pmm_lock = MCS_LOCK_INIT;
+static mcs_node pmm_nodes[NCPU];
+
+page *pa_to_page(void *pa) {
+  kassert((uint64)pa >= free_mem_start_addr && (uint64)pa < free_mem_end_addr);
+  return &g_pages[((uint64)pa - free_mem_start_addr) >> PGSHIFT];
+}
+
+void *page_to_pa(page *pg) {
+  return (void *)(free_mem_start_addr + ((uint64)(pg - g_pages) << PGSHIFT));
+}
+
+static void free_list_add(page *pg, int order) {
+  page *head = &free_area[order];
+  pg->order = order;
+  pg->next = head->next;
+  pg->prev = head;
+  head->next->prev = pg;
+  head->next = pg;
+}
+
+static void free_list_del(page *pg) {
+  pg->prev->next = pg->next;
+  pg->next->prev = pg->prev;
+  pg->order = PAGE_NOT_FREE;
+}
+
+//
+// put the pages [start, end) (indices into g_pages) into the free lists, carving them
+// into the largest blocks that are aligned to their own size.
+//
+static void pmm_add_range(uint64 start, uint64 end) {
+  while (start < end) {
+    int order = PMM_MAX_ORDER - 1;
+    while (order > 0 && ((start & ((1UL << order) - 1)) || start + (1UL << order) > end))
+      order--;
+    free_list_add(&g_pages[start], order);
+    nr_free_pages += 1UL << order;
+    start += 1UL << order;
+  }
+}
+
+//
+// allocate a block of 2^order pages. returns NULL if no block is large enough.
+//
+void *alloc_pages(int order) {
+  if (order < 0 || order >= PMM_MAX_ORDER) return NULL;
+
+  mcs_lock(&pmm_lock, &pmm_nodes[cpuid()]);
+  int o = order;
+  while (o < PMM_MAX_ORDER && free_area[o].next == &free_area[o]) o++;
+  if (o == PMM_MAX_ORDER) {
+    mcs_unlock(&pmm_lock, &pmm_nodes[cpuid()]);
+    return NULL;
+  }
+
+  page *pg = free_area[o].next;
+  free_list_del(pg);
+  // split the block, giving the upper halves back to the lower orders.
+  while (o > order) {
+    o--;
+    free_list_add(pg + (1UL << o), o);
+  }
+  nr_free_pages -= 1UL << order;
+  mcs_unlock(&pmm_lock, &pmm_nodes[cpuid()]);
+
+  return page_to_pa(pg);
+}
+
+//
+// free a block of 2^order pages, merging it with its buddies as far as possible.
+// freeing the pages of a larger allocation one by one (with order 0) is allowed.
+//
+void free_pages(void *pa, int order) {
+  if (((uint64)pa % PGSIZE) != 0 || order < 0 || order >= PMM_MAX_ORDER)
+    panic("free_pages: bad block %p of order %d.\n", pa, order);
+
+  mcs_lock(&pmm_lock, &pmm_nodes[cpuid()]);
+  uint64 idx = pa_to_page(pa) - g_pages;
+  nr_free_pages += 1UL << order;
+  while (order < PMM_MAX_ORDER - 1) {
+    uint64 buddy = idx ^ (1UL << order);
+    if (buddy >= g_npages || g_pages[buddy].order != order) break;
+    free_list_del(&g_pages[buddy]);
+    idx &= ~(1UL << order);
+    order++;
+  }
+  free_list_add(&g_pages[idx], order);
+  mcs_unlock(&pmm_lock, &pmm_nodes[cpuid()]);
+}
+
+void *alloc_page(void) { return alloc_pages(0); }
+
+void free_page(void *pa) { free_pages(pa, 0); }
+
+uint64 pmm_free_pages(void) { return nr_free_pages; }
+
+//
+// one more mapping of the user page at pa.
+//
+void page_share(void *pa) { atomic_add(&pa_to_page(pa)->shares, 1); }
+
+//
+// drop a mapping of the user page at pa, and free the page if it was the last one. the
+// mappings are dropped by different harts at once, the counter decides which one frees.
+//
+void page_put(void *pa) {
+  page *pg = pa_to_page(pa);
+  if (atomic_add(&pg->shares, -1) == 0) {
+    pg->shares = 0;
+    free_page(pa);
+  }
+}
+
+//
+// is the user page at pa mapped more than once? a page mapped once stays so: only its
+// owner could share it again.
+//
+int page_shared(void *pa) { return atomic_read(&pa_to_page(pa)->shares) > 0; }
+
+//
+// pmm_init() establishes the buddy allocator over the memory left after the kernel.
+//
+void pmm_init() {
+  // start of kernel program segment
+  uint64 g_kernel_start = DRAM_BASE;
+  uint64 g_kernel_end = (uint64)&_end;
+
+  uint64 pke_kernel_size = g_kernel_end - g_kernel_start;
+  sprint("PKE kernel start 0x%lx, PKE kernel end: 0x%lx, PKE kernel size: 0x%lx .\n",
+    g_kernel_start, g_kernel_end, pke_kernel_size);
+
+  // the page descriptors occupy the memory right after the kernel image, and the
+  // managed pages follow them.
+  uint64 mem_start = ROUNDUP(g_kernel_end, PGSIZE);
+  free_mem_end_addr = DRAM_BASE + g_mem_size;
+  uint64 max_pages = (free_mem_end_addr - mem_start) >> PGSHIFT;
+  g_pages = (page *)mem_start;
+  free_mem_start_addr = ROUNDUP(mem_start + max_pages * sizeof(page), PGSIZE);
+  g_npages = (free_mem_end_addr - free_mem_start_addr) >> PGSHIFT;
+
+  memset(g_pages, 0, g_npages * sizeof(page));
+  for (uint64 i = 0; i < g_npages; i++) g_pages[i].order = PAGE_NOT_FREE;
+  for (int o = 0; o < PMM_MAX_ORDER; o++) free_area[o].next = free_area[o].prev = &free_area[o];
+
+  pmm_add_range(0, g_npages);
+
+  sprint("free physical memory address: [0x%lx, 0x%lx], %ld pages are free.\n",
+    free_mem_start_addr, free_mem_end_addr - 1, nr_free_pages);
+}
@@ -0,0 +1,49 @@
+#ifndef _PMM_H_
+#define _PMM_H_
+
+#include "util/types.h"
+
+// the buddy allocator manages blocks of 2^0 ... 2^(PMM_MAX_ORDER-1) pages.
+#define PMM_MAX_ORDER 16
+
+// marks a page that is not the head of a free block.
+#define PAGE_NOT_FREE (-1)
+
+// descriptor of a physical page. one descriptor exists for every managed page.
+typedef struct page_t {
+  // links in the free list of the block's order (valid only for free block heads).
+  struct page_t *next, *prev;
+  // order of the free block headed by this page, PAGE_NOT_FREE otherwise.
+  int16 order;
+  // the slab (see kernel/slab.c) that the page belongs to, if any.
+  void *slab;
+  // the mappings of a user page beyond the first one, i.e., 0 for a page mapped once.
+  // pages are shared copy-on-write between a process and its forks (see kernel/vma.c).
+  int shares;
+} page;
+
+// initialize the buddy allocator with the memory left after the kernel image.
+void pmm_init();
+
+// allocate/free a physically contiguous block of 2^order pages.
+void *alloc_pages(int order);
+void free_pages(void *pa, int order);
+
+// allocate/free a single physical page.
+void *alloc_page();
+void free_page(void *pa);
+
+// references to user pages: share a page with one more mapping, drop a mapping (the page
+// is freed with the last one), and tell whether other mappings are left.
+void page_share(void *pa);
+void page_put(void *pa);
+int page_shared(void *pa);
+
+// number of pages that are currently free.
+uint64 pmm_free_pages();
+
+// conversion between physical addresses and page descriptors.
+page *pa_to_page(void *pa);
+void *page_to_pa(page *pg);
+
+#endif
@@ -1,9 +1,14 @@
 /*
  * Utility functions for process management. 
  *
- * Note: in Lab1, only one process (i.e., our user application) exists. Therefore, 
- * PKE OS at this stage will set "current" to the loaded user application, and also
- * switch to the old "current" process after trap handling.
+ * every application named on the command line runs as a process, and processes create
+ * more with fork(). "current" is the one running on the calling hart; the others run on
+ * other harts, or wait in the run queues of the scheduler (see kernel/sched.c), which
+ * picks the next process at the end of a time slice.
+ *
+ * processes live in a fixed table of NPROC slots, and are named by pids that are not
+ * reused. an exited process keeps its slot (as a ZOMBIE) until its parent collects its
+ * exit code with wait(); the children of an exited parent are reaped as they exit.
  */
 
 #include "riscv.h"
@@ -12,15 +17,284 @@
 #include "process.h"
 #include "elf.h"
 #include "string.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "slab.h"
+#include "sched.h"
+#include "memlayout.h"
 
 #include "spike_interface/spike_utils.h"
+#include "spike_interface/atomic.h"
 
 //Two functions defined in kernel/usertrap.S
 extern char smode_trap_vector[];
-extern void return_to_user(trapframe*);
+extern void return_to_user(trapframe*, uint64 satp);
+
+// current_procs[hartid] points to the user-mode application running on the hart.
+process* current_procs[NCPU];
+
+// the process table. proc_lock protects the allocation of its slots, and the parent
+// links, exit codes and on_cpu flags of the exited processes.
+static process proc_table[NPROC];
+static spinlock_t proc_lock = SPINLOCK_INIT;
+static int next_pid = 1;
+
+// slab cache (see kernel/slab.c) that trapframes are allocated from.
+static kmem_cache *trapframe_cache;
+
+//
+// initialize the cache of trapframes. must be called before alloc_process().
+//
+void init_proc_pool() {
+  trapframe_cache = kmem_cache_create("trapframe", sizeof(trapframe), 0, NULL);
+}
+
+// give the slot of proc back to the table. called with proc_lock held.
+static void proc_slot_free(process* proc) {
+  proc->pid = 0;
+  proc->parent = NULL;
+  proc->status = FREE;
+}
+
+//
+// take a free slot of the table, with a new pid, a trapframe, a kernel stack and an empty
+// page table. returns NULL if the table or the memory is full.
+//
+static process* proc_slot_alloc(void) {
+  process* proc = NULL;
+  spinlock_lock(&proc_lock);
+  for (int i = 0; i < NPROC; i++)
+    if (proc_table[i].status == FREE) {
+      proc = &proc_table[i];
+      memset(proc, 0, sizeof(process));
+      proc->pid = next_pid++;
+      proc->status = NEW;
+      break;
+    }
+  spinlock_unlock(&proc_lock);
+  if (proc == NULL) return NULL;
+
+  trapframe* tf = (trapframe*)kmem_cache_alloc(trapframe_cache);
+  // the kernel stack is allocated by the buddy allocator (alloc_pages() is defined in
+  // kernel/pmm.c). its order is defined in kernel/config.h
+  void* kstack = alloc_pages(USER_KSTACK_ORDER);
+  // user page table. user_pagetable_create() is defined in kernel/vmm.c
+  pagetable_t pagetable = user_pagetable_create();
+  if (!tf || !kstack || !pagetable) {
+    if (tf) kmem_cache_free(trapframe_cache, tf);
+    if (kstack) free_pages(kstack, USER_KSTACK_ORDER);
+    if (pagetable) free_page(pagetable);
+    spinlock_lock(&proc_lock);
+    proc_slot_free(proc);
+    spinlock_unlock(&proc_lock);
+    return NULL;
+  }
+
+  proc->trapframe = tf;
+  memset(proc->trapframe, 0, sizeof(trapframe));
+  // the kernel stack grows downwards, so we keep its top address.
+  proc->kstack = (uint64)kstack + (PGSIZE << USER_KSTACK_ORDER);
+  proc->pagetable = pagetable;
+  return proc;
+}
+
+//
+// drop a process that failed to be set up (it never ran): its files, areas, memory and
+// slot.
+//
+static void proc_discard(process* proc) {
+  for (int fd = 0; fd < NOFILE; fd++)
+    if (proc->ofile[fd]) file_put(proc->ofile[fd]);
+  while (proc->vmas) vma_remove(proc, proc->vmas);
+  user_pagetable_free(proc->pagetable);
+  free_pages((void*)(proc->kstack - (PGSIZE << USER_KSTACK_ORDER)), USER_KSTACK_ORDER);
+  kmem_cache_free(trapframe_cache, proc->trapframe);
+  spinlock_lock(&proc_lock);
+  proc_slot_free(proc);
+  spinlock_unlock(&proc_lock);
+}
+
+//
+// allocate an empty process with its trapframe, kernel stack, page table and user stack
+// area. the elf of the program is to be loaded by the caller. returns NULL if the process
+// table or the memory is full.
+//
+process* alloc_process() {
+  process* proc = proc_slot_alloc();
+  if (proc == NULL) return NULL;
+
+  // the user stack is an anonymous area right below USER_STACK_TOP (defined in
+  // kernel/memlayout.h), whose pages are populated on demand. vma_add() is defined in
+  // kernel/vma.c
+  if (vma_add(proc, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_TOP, PROT_READ | PROT_WRITE,
+        NULL, 0, 0, 0) == NULL) {
+    proc_discard(proc);
+    return NULL;
+  }
+  proc->trapframe->regs.sp = USER_STACK_TOP;  // virtual address of user stack top
+
+  // standard input, output and error. file_console() is defined in kernel/file.c
+  for (int fd = 0; fd < 3; fd++) proc->ofile[fd] = file_console(fd);
+
+  sprint("user frame 0x%lx, user stack 0x%lx, user kstack 0x%lx \n", proc->trapframe,
+         proc->trapframe->regs.sp, proc->kstack);
+  return proc;
+}
+
+//
+// create a child of process parent: a copy of its memory (shared copy-on-write, see
+// vma_dup() in kernel/vma.c), open files and registers, that returns 0 from the fork.
+// parent must be the current process, with its complete context in its trapframe. returns
+// the child, not queued for the scheduler yet, or NULL if the table or the memory is full.
+//
+process* fork_process(process* parent) {
+  process* child = proc_slot_alloc();
+  if (child == NULL) return NULL;
+
+  if (vma_dup(child, parent) != 0) {
+    proc_discard(child);
+    return NULL;
+  }
+  child->heap_start = parent->heap_start;
+  child->brk = parent->brk;
+
+  // the descriptors of the child share the open files (and their positions) of parent.
+  for (int fd = 0; fd < NOFILE; fd++)
+    if (parent->ofile[fd]) {
+      child->ofile[fd] = parent->ofile[fd];
+      file_get(child->ofile[fd]);
+    }
+
+  child->trapframe->regs = parent->trapframe->regs;
+  child->trapframe->epc = parent->trapframe->epc;
+  child->trapframe->regs.a0 = 0;
+  child->parent = parent;
+  return child;
+}
+
+//
+// replace the program of process p, the current process, with the elf at path. the open
+// files are kept. the new image is built aside first, so a failed exec leaves p as it was.
+// returns 0, or -1 if the program cannot be loaded.
+//
+int exec_process(process* p, const char* path) {
+  // a process of its own would take a slot of the table, the image needs none of it.
+  trapframe tf;
+  process img;
+  memset(&img, 0, sizeof(img));
+  img.trapframe = &tf;
+  if ((img.pagetable = user_pagetable_create()) == NULL) return -1;
+
+  if (vma_add(&img, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_TOP, PROT_READ | PROT_WRITE,
+        NULL, 0, 0, 0) == NULL ||
+      load_bincode_from_host_elf(&img, path) != 0) {
+    while (img.vmas) vma_remove(&img, img.vmas);
+    user_pagetable_free(img.pagetable);
+    return -1;
+  }
+
+  // drop the old image, and move to the new page table before freeing the old one. the
+  // calling hart is the only one that holds the old root: the harts that ran p before
+  // switched to the kernel page table (and flushed their TLBs) when they left it, see
+  // put_prev() in kernel/sched.c.
+  kassert(p == current);
+  while (p->vmas) vma_remove(p, p->vmas);
+  pagetable_t old = p->pagetable;
+  p->pagetable = img.pagetable;
+  p->vmas = img.vmas;
+  p->heap_start = img.heap_start;
+  p->brk = img.brk;
+  p->heap = img.heap;
+  write_csr(satp, MAKE_SATP(p->pagetable));
+  flush_tlb();
+  user_pagetable_free(old);
+
+  memset(&p->trapframe->regs, 0, sizeof(riscv_regs));
+  p->trapframe->regs.sp = USER_STACK_TOP;
+  p->trapframe->epc = tf.epc;
+  return 0;
+}
+
+//
+// collect an exited child of process p (the current process): pid, or any child if pid
+// is -1. its exit code is stored in *code. returns the pid of the child, 0 if p has been
+// put to sleep until a child exits (its syscall restarts then, see sleep_retry()), or -1
+// if p has no such child.
+//
+long wait_process(process* p, long pid, int* code) {
+  int found = 0;
+  spinlock_lock(&proc_lock);
+  for (int i = 0; i < NPROC; i++) {
+    process* c = &proc_table[i];
+    if (c->parent != p || (pid != -1 && c->pid != pid)) continue;
+    found = 1;
+    // the exited child is collected once its hart has left it, see free_process().
+    if (c->status == ZOMBIE && !c->on_cpu) {
+      long cpid = c->pid;
+      *code = c->exit_code;
+      proc_slot_free(c);
+      spinlock_unlock(&proc_lock);
+      return cpid;
+    }
+  }
+  // the exiting child wakes p only after it takes proc_lock, which p holds until it is
+  // asleep. sleep_retry() is defined in kernel/sched.c
+  if (found) sleep_retry(p);
+  spinlock_unlock(&proc_lock);
+  return found ? 0 : -1;
+}
+
+//
+// release what process proc holds in user space when it exits with code: its open files,
+// and its areas with their pages. its children are orphaned. the process keeps running on
+// its kernel stack (and its page table) until it is switched away from, and is freed
+// later by free_process().
+//
+void exit_process(process* proc, int code) {
+  for (int fd = 0; fd < NOFILE; fd++)
+    if (proc->ofile[fd]) {
+      file_put(proc->ofile[fd]);
+      proc->ofile[fd] = NULL;
+    }
+
+  // vma_remove() is defined in kernel/vma.c
+  while (proc->vmas) vma_remove(proc, proc->vmas);
+  proc->heap = NULL;
 
-// current points to the currently running user-mode application.
-process* current = NULL;
+  spinlock_lock(&proc_lock);
+  proc->exit_code = code;
+  proc->status = ZOMBIE;
+  // nobody waits for the children any more. those that have exited already are reaped.
+  for (int i = 0; i < NPROC; i++) {
+    process* c = &proc_table[i];
+    if (c->parent != proc) continue;
+    c->parent = NULL;
+    if (c->status == ZOMBIE && !c->on_cpu) proc_slot_free(c);
+  }
+  spinlock_unlock(&proc_lock);
+}
+
+//
+// free what is left of an exited process: its page table, kernel stack and trapframe. its
+// slot is kept for the parent to collect the exit code, or freed if it has no parent.
+// must not be called on the kernel stack of proc.
+//
+void free_process(process* proc) {
+  user_pagetable_free(proc->pagetable);
+  free_pages((void*)(proc->kstack - (PGSIZE << USER_KSTACK_ORDER)), USER_KSTACK_ORDER);
+  kmem_cache_free(trapframe_cache, proc->trapframe);
+  proc->pagetable = NULL;
+  proc->trapframe = NULL;
+
+  spinlock_lock(&proc_lock);
+  proc->on_cpu = 0;
+  process* parent = proc->parent;
+  if (parent == NULL) proc_slot_free(proc);
+  spinlock_unlock(&proc_lock);
+  // the parent may wait for the child in wait_process(). wakeup() is defined in
+  // kernel/sched.c
+  if (parent) wakeup(parent);
+}
 
 //
 // switch to a user-mode process
@@ -28,6 +302,7 @@ process* current = NULL;
 void switch_to(process* proc) {
   assert(proc);
   current = proc;
+  proc->status = RUNNING;
 
   // write the smode_trap_vector (64-bit func. address) defined in kernel/strap_vector.S
   // to the stvec privilege register, such that trap handler pointed by smode_trap_vector
@@ -38,6 +313,7 @@ void switch_to(process* proc) {
   // the process next re-enters the kernel.
   proc->trapframe->kernel_sp = proc->kstack;  // process's kernel stack
   proc->trapframe->kernel_trap = (uint64)smode_trap_handler;
+  proc->trapframe->kernel_hartid = read_tp();  // hart id, see cpuid() in kernel/riscv.h
 
   // SSTATUS_SPP and SSTATUS_SPIE are defined in kernel/riscv.h
   // set S Previous Privilege mode (the SSTATUS_SPP bit in sstatus register) to User mode.
@@ -51,6 +327,10 @@ void switch_to(process* proc) {
   // set S Exception Program Counter (sepc register) to the elf entry pc.
   write_csr(sepc, proc->trapframe->epc);
 
+  // make user page table. macro MAKE_SATP is defined in kernel/riscv.h.
+  uint64 user_satp = MAKE_SATP(proc->pagetable);
+
   // return_to_user() is defined in kernel/strap_vector.S. switch to user mode with sret.
-  return_to_user(proc->trapframe);
+  // note, return_to_user takes two parameters @ and after lab2_1.
+  return_to_user(proc->trapframe, user_satp);
 }
@@ -2,6 +2,9 @@
 #define _PROC_H_
 
 #include "riscv.h"
+#include "vma.h"
+#include "file.h"
+#include "config.h"
 
 typedef struct trapframe_t {
   // space to store context (all common registers)
@@ -13,18 +16,78 @@ typedef struct trapframe_t {
   /* offset:256 */ uint64 kernel_trap;
   // saved user process counter
   /* offset:264 */ uint64 epc;
+  // id of the hart the process runs on, loaded into tp when entering the kernel
+  /* offset:272 */ uint64 kernel_hartid;
 }trapframe;
 
+// states of a process
+typedef enum proc_status_t {
+  FREE,     // not in use
+  NEW,      // allocated, being set up
+  READY,    // in the ready queue
+  RUNNING,  // the current process
+  BLOCKED,  // sleeping until wakeup() of its wait channel
+  ZOMBIE,   // exited, waiting for its parent to collect its exit code
+} proc_status;
+
 // the extremely simple definition of process, used for begining labs of PKE
 typedef struct process_t {
+  // process id, and the process that forked this one (NULL for the processes of the
+  // command line, and for orphans). see kernel/process.c
+  int pid;
+  struct process_t *parent;
+  // the code passed to exit(), for the parent to collect with wait().
+  int exit_code;
+
   // pointing to the stack used in trap handling.
   uint64 kstack;
+  // user page table
+  pagetable_t pagetable;
   // trapframe storing the context of a (User mode) process.
   trapframe* trapframe;
+
+  // virtual memory areas of the process, populated on demand (see kernel/vma.c).
+  vm_area *vmas;
+
+  // the heap starts right after the last elf segment, and ends at brk (moved by sbrk).
+  // heap is the (anonymous) area that covers [heap_start, brk).
+  uint64 heap_start, brk;
+  vm_area *heap;
+
+  // open files, indexed by file descriptor. 0, 1 and 2 are the console.
+  kfile *ofile[NOFILE];
+
+  // scheduling state (see kernel/sched.c): the link of the run (or blocked) queue, the
+  // channel a blocked process waits on, the ticks left of its time slice, and the hart it
+  // ran on last. on_cpu is set while a hart runs the process (or its kernel stack is still
+  // in use), it is cleared under the lock of the scheduler, or under the lock of the
+  // process table once the process is a ZOMBIE.
+  proc_status status;
+  struct process_t *queue_next;
+  void *wait_chan;
+  int ticks_left;
+  int hart;
+  int on_cpu;
+
+  // the request to a host file the process sleeps on, see kernel/file.c
+  host_io hio;
 }process;
 
 void switch_to(process*);
+void exit_process(process*, int code);
+void free_process(process*);
+
+// initialize the process table and the slab cache of trapframes
+void init_proc_pool();
+// allocate an empty process, or NULL if the table (or the memory) is full
+process* alloc_process();
+// the syscalls of the process table. see kernel/process.c
+process* fork_process(process* parent);
+int exec_process(process* p, const char* path);
+long wait_process(process* p, long pid, int* code);
 
-extern process* current;
+// the process running on each hart. current is the one of the calling hart.
+extern process* current_procs[NCPU];
+#define current (current_procs[cpuid()])
 
 #endif
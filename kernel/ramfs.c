@@ -0,0 +1,206 @@
+/*
+ * the initramfs: a cpio archive (newc format) that is read from the host once at boot,
+ * and serves its files from memory afterwards.
+ *
+ * the whole archive is read into one physically contiguous block, with a few large host
+ * reads. the regular files in it are indexed by a hash table of their paths, and their
+ * names and data are used in place, so opening and reading a file of the initramfs costs
+ * no host request at all. the files are read-only.
+ */
+
+#include "ramfs.h"
+#include "pmm.h"
+#include "slab.h"
+#include "riscv.h"
+#include "string.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+// the archive is read from the host in pieces of this size.
+#define RAMFS_READ_CHUNK (1UL << 20)
+#define RAMFS_HASH_SIZE 256
+
+// the fixed part of a newc header: a magic number and 13 fields of 8 hex digits, followed
+// by the name. the name and the data are each padded to 4 bytes.
+#define CPIO_NEWC_MAGIC "070701"
+#define CPIO_HDR_SIZE 110
+#define CPIO_TRAILER "TRAILER!!!"
+#define CPIO_F_INO 0
+#define CPIO_F_MODE 1
+#define CPIO_F_MTIME 5
+#define CPIO_F_FILESIZE 6
+#define CPIO_F_NAMESIZE 11
+
+#define S_IFMT_MASK 0170000
+#define S_IFREG_BITS 0100000
+
+static ramfs_node *ramfs_hash[RAMFS_HASH_SIZE];
+static kmem_cache *ramfs_node_cache;
+static int ramfs_files;
+
+// FNV-1a hash of a path.
+static uint64 ramfs_bucket(const char *path) {
+  uint64 h = 0xcbf29ce484222325UL;
+  for (; *path; path++) h = (h ^ (uint8)*path) * 0x100000001b3UL;
+  return h & (RAMFS_HASH_SIZE - 1);
+}
+
+// paths are looked up without a leading "/" or "./".
+static const char *ramfs_strip(const char *path) {
+  while (1) {
+    if (path[0] == '/')
+      path++;
+    else if (path[0] == '.' && path[1] == '/')
+      path += 2;
+    else
+      return path;
+  }
+}
+
+//
+// the regular file of the initramfs at path, or NULL.
+//
+ramfs_node *ramfs_lookup(const char *path) {
+  if (ramfs_files == 0) return NULL;
+  path = ramfs_strip(path);
+  for (ramfs_node *n = ramfs_hash[ramfs_bucket(path)]; n; n = n->hnext)
+    if (strcmp(n->name, path) == 0) return n;
+  return NULL;
+}
+
+// the value of field idx of the header at hdr (8 hex digits), or -1 if it is malformed.
+static int64 cpio_field(const char *hdr, int idx) {
+  const char *s = hdr + 6 + idx * 8;
+  int64 v = 0;
+  for (int i = 0; i < 8; i++) {
+    char c = s[i];
+    int d;
+    if (c >= '0' && c <= '9')
+      d = c - '0';
+    else if (c >= 'a' && c <= 'f')
+      d = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      d = c - 'A' + 10;
+    else
+      return -1;
+    v = v * 16 + d;
+  }
+  return v;
+}
+
+//
+// index the regular files of the archive of size bytes at base. returns the number of
+// files, or -1 if the archive is malformed.
+//
+static int ramfs_parse(char *base, uint64 size) {
+  if (ramfs_node_cache == NULL)
+    ramfs_node_cache = kmem_cache_create("ramfs_node", sizeof(ramfs_node), 0, NULL);
+
+  int files = 0;
+  uint64 off = 0;
+  while (1) {
+    if (off + CPIO_HDR_SIZE > size) return -1;
+    char *hdr = base + off;
+    for (int i = 0; i < 6; i++)
+      if (hdr[i] != CPIO_NEWC_MAGIC[i]) return -1;
+
+    int64 mode = cpio_field(hdr, CPIO_F_MODE), filesize = cpio_field(hdr, CPIO_F_FILESIZE);
+    int64 namesize = cpio_field(hdr, CPIO_F_NAMESIZE);
+    if (mode < 0 || filesize < 0 || namesize <= 0) return -1;
+
+    char *name = hdr + CPIO_HDR_SIZE;
+    uint64 data_off = ROUNDUP(off + CPIO_HDR_SIZE + namesize, 4);
+    if (data_off + filesize > size || name[namesize - 1] != 0) return -1;
+    if (strcmp(name, CPIO_TRAILER) == 0) break;
+
+    if ((mode & S_IFMT_MASK) == S_IFREG_BITS) {
+      const char *path = ramfs_strip(name);
+      ramfs_node *n = (ramfs_node *)kmem_cache_alloc(ramfs_node_cache);
+      if (n == NULL) return -1;
+      n->name = path;
+      n->data = (uint8 *)base + data_off;
+      n->size = filesize;
+      n->ino = cpio_field(hdr, CPIO_F_INO);
+      n->mtime = cpio_field(hdr, CPIO_F_MTIME);
+      n->mode = mode;
+
+      uint64 b = ramfs_bucket(path);
+      n->hnext = ramfs_hash[b];
+      ramfs_hash[b] = n;
+      files++;
+    }
+    off = ROUNDUP(data_off + filesize, 4);
+  }
+  return files;
+}
+
+// give back the pages of the archive of size bytes at base, see ramfs_read_archive().
+static void ramfs_free_archive(char *base, uint64 size) {
+  for (uint64 off = 0; off < size; off += PGSIZE) free_page(base + off);
+}
+
+//
+// read the whole host file f into a block of pages, with reads of RAMFS_READ_CHUNK bytes.
+// returns the block (its size in *size, the number of reads added to *reads), or NULL.
+//
+static char *ramfs_read_archive(spike_file_t *f, uint64 *size, int *reads) {
+  struct frontend_stat st;
+  if (frontend_syscall(HTIFSYS_fstat, f->kfd, (uint64)&st, 0, 0, 0, 0, 0) < 0 || st.size == 0)
+    return NULL;
+
+  // one block for the whole archive. the pages beyond its end are given back one by one.
+  uint64 npages = ROUNDUP(st.size, PGSIZE) / PGSIZE;
+  int order = 0;
+  while ((1UL << order) < npages) order++;
+  char *base = (char *)alloc_pages(order);
+  if (base == NULL) return NULL;
+  for (uint64 i = npages; i < (1UL << order); i++) free_page(base + i * PGSIZE);
+
+  uint64 done = 0;
+  while (done < st.size) {
+    ssize_t r = spike_file_pread(f, base + done, MIN(st.size - done, RAMFS_READ_CHUNK), done);
+    if (r <= 0) {
+      ramfs_free_archive(base, st.size);
+      return NULL;
+    }
+    done += r;
+    (*reads)++;
+  }
+  *size = st.size;
+  return base;
+}
+
+//
+// read the cpio archive at host_path into memory and index its files. returns the
+// number of files, or -1. the archive stays in memory for good.
+//
+int ramfs_load(const char *host_path) {
+  spike_file_t *f = spike_file_open(host_path, O_RDONLY, 0);
+  if (IS_ERR_VALUE(f)) return -1;
+  // spike_file_open() returns the file with an extra reference, see file_open().
+  spike_file_decref(f);
+
+  uint64 size = 0;
+  int reads = 0;
+  char *base = ramfs_read_archive(f, &size, &reads);
+  spike_file_decref(f);
+  if (base == NULL) return -1;
+
+  int ret = ramfs_parse(base, size);
+  if (ret < 0) {
+    // a malformed archive is not used at all: the nodes indexed so far and the archive are
+    // given back.
+    for (int b = 0; b < RAMFS_HASH_SIZE; b++) {
+      while (ramfs_hash[b]) {
+        ramfs_node *n = ramfs_hash[b];
+        ramfs_hash[b] = n->hnext;
+        kmem_cache_free(ramfs_node_cache, n);
+      }
+    }
+    ramfs_free_archive(base, size);
+    return -1;
+  }
+  ramfs_files = ret;
+  sprint("initramfs: %s, %d files, %ld bytes in %d host reads.\n", host_path, ret, size, reads);
+  return ret;
+}
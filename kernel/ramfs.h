@@ -0,0 +1,23 @@
+#ifndef _RAMFS_H_
+#define _RAMFS_H_
+
+#include "util/types.h"
+
+// a regular file of the initramfs. name and data point into the archive in memory.
+typedef struct ramfs_node_t {
+  const char *name;  // path without the leading "/" or "./"
+  const uint8 *data;
+  uint64 size;
+  uint64 ino, mtime;
+  uint32 mode;
+  // chain of the hash bucket
+  struct ramfs_node_t *hnext;
+} ramfs_node;
+
+// device number reported by fstat() for the files of the initramfs.
+#define RAMFS_DEV 0x72616d
+
+int ramfs_load(const char *host_path);
+ramfs_node *ramfs_lookup(const char *path);
+
+#endif
@@ -4,6 +4,10 @@
 #include "util/types.h"
 #include "config.h"
 
+// page size
+#define PGSIZE 4096  // bytes per page
+#define PGSHIFT 12   // offset bits within a page
+
 // fields of mstatus, the Machine mode Status register
 #define MSTATUS_MPP_MASK (3L << 11) // previous mode mask
 #define MSTATUS_MPP_M (3L << 11)    // machine mode (m-mode)
@@ -52,6 +56,12 @@
 #define CAUSE_LOAD_PAGE_FAULT 0xd      // Load page fault
 #define CAUSE_STORE_PAGE_FAULT 0xf     // Store/AMO page fault
 
+// interrupts, as reported by mcause/scause (the top bit marks an interrupt)
+#define CAUSE_SSOFT 0x8000000000000001   // supervisor software interrupt
+#define CAUSE_MSOFT 0x8000000000000003   // machine software interrupt
+#define CAUSE_STIMER 0x8000000000000005  // supervisor timer interrupt
+#define CAUSE_MTIMER 0x8000000000000007  // machine timer interrupt
+
 // fields of sstatus, the Supervisor mode Status register
 #define SSTATUS_SPP (1L << 8)   // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5)  // Supervisor Previous Interrupt Enable
@@ -135,6 +145,56 @@ static inline uint64 read_tp(void) {
 // write tp, the thread pointer, holding hartid (core number), the index into cpus[].
 static inline void write_tp(uint64 x) { asm volatile("mv tp, %0" : : "r"(x)); }
 
+// the id of the hart we are running on. the kernel keeps it in tp (set up in m_start(),
+// and reloaded from the trapframe when entering the kernel from user mode).
+static inline int cpuid(void) { return read_tp(); }
+
+// use riscv's sv39 page table scheme.
+#define SATP_SV39 (8L << 60)
+#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+
+#define PTE_V (1L << 0)  // valid
+#define PTE_R (1L << 1)  // readable
+#define PTE_W (1L << 2)  // writable
+#define PTE_X (1L << 3)  // executable
+#define PTE_U (1L << 4)  // 1->user can access, 0->otherwise
+#define PTE_G (1L << 5)  // global
+#define PTE_A (1L << 6)  // accessed
+#define PTE_D (1L << 7)  // dirty
+
+// shift a physical address to the right place for a PTE.
+#define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
+
+// convert a pte content into its corresponding physical address
+#define PTE2PA(pte) (((pte) >> 10) << 12)
+
+// extract the property bits of a pte
+#define PTE_FLAGS(pte) ((pte)&0x3FF)
+
+// a valid pte with any of R, W or X set is a leaf, otherwise it points to the next level.
+#define PTE_LEAF(pte) (((pte) & (PTE_R | PTE_W | PTE_X)) != 0)
+
+// extract the three 9-bit page table indices from a virtual address.
+#define PXMASK 0x1FF  // 9 bits
+
+#define PXSHIFT(level) (PGSHIFT + (9 * (level)))
+#define PX(level, va) ((((uint64)(va)) >> PXSHIFT(level)) & PXMASK)
+
+// size of the memory mapped by a leaf pte at a level: 4KB (0), 2MB (1) and 1GB (2).
+#define PXSIZE(level) (1UL << PXSHIFT(level))
+
+// one beyond the highest possible virtual address.
+// MAXVA is actually one bit less than the max allowed by
+// Sv39, to avoid having to sign-extend virtual addresses
+// that have the high bit set.
+#define MAXVA (1L << (9 + 9 + 9 + 12 - 1))
+
+typedef uint64 pte_t;
+typedef uint64 *pagetable_t;  // 512 PTEs
+
+// flush the TLB.
+static inline void flush_tlb(void) { asm volatile("sfence.vma zero, zero"); }
+
 typedef struct riscv_regs_t {
   /*  0  */ uint64 ra;
   /*  8  */ uint64 sp;
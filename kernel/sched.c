@@ -0,0 +1,314 @@
+/*
+ * the round-robin scheduler of user processes, with a run queue per hart.
+ *
+ * runnable processes wait in the FIFO run queue of a hart. a process runs for
+ * SCHED_TIME_SLICE timer ticks (see kernel/config.h), and is then put at the tail of the
+ * queue of its hart if another process is ready there. a hart with an empty queue steals
+ * the oldest process of the busiest peer, and idles until a tick or an IPI (see
+ * sched_kick()) if there is none. the kernel itself is not preemptive: ticks are taken
+ * only while user code runs, or while a hart idles.
+ *
+ * a process that has to wait (e.g., for console input) is put on the blocked list with a
+ * wait channel, and its syscall is restarted once wakeup() is called on the channel. the
+ * kernel keeps no context of a sleeping syscall, so the kernel stack of a process is
+ * free as soon as its hart leaves it. schedule() leaves it first, for the scheduler stack
+ * of the hart, and only then makes the process visible to the other harts: a process
+ * woken before its hart has left it (on_cpu) is queued by that hart, in put_prev().
+ */
+
+#include "sched.h"
+#include "riscv.h"
+#include "strap.h"
+#include "vmm.h"
+#include "spike_interface/atomic.h"
+#include "machine/mtrap.h"
+#include "spike_interface/spike_utils.h"
+
+typedef struct run_queue_t {
+  spinlock_t lock;
+  process *head, *tail;
+  int nr;  // processes in the queue
+  // the process the hart left in schedule(), to be queued (or freed) once the hart runs
+  // on its scheduler stack.
+  process *prev;
+  // is the hart waiting for work in idle()?
+  volatile int idle;
+  int online;
+} __attribute__((aligned(64))) run_queue;
+
+static run_queue run_queues[NCPU];
+// the stacks the harts schedule (and idle) on, off the kernel stacks of processes.
+static __attribute__((aligned(16))) char sched_stacks[NCPU][2 * PGSIZE];
+
+// protects the blocked list, nr_alive, and the on_cpu flags of the processes that are
+// not ZOMBIEs.
+static spinlock_t sched_lock = SPINLOCK_INIT;
+static process* blocked_queue_head = NULL;
+// processes that have not exited yet.
+static int nr_alive = 0;
+
+static void rq_push(run_queue* rq, process* proc) {
+  proc->status = READY;
+  proc->queue_next = NULL;
+  spinlock_lock(&rq->lock);
+  if (rq->tail)
+    rq->tail->queue_next = proc;
+  else
+    rq->head = proc;
+  rq->tail = proc;
+  rq->nr++;
+  spinlock_unlock(&rq->lock);
+}
+
+static process* rq_pop(run_queue* rq) {
+  spinlock_lock(&rq->lock);
+  process* proc = rq->head;
+  if (proc) {
+    rq->head = proc->queue_next;
+    if (rq->head == NULL) rq->tail = NULL;
+    rq->nr--;
+    proc->queue_next = NULL;
+  }
+  spinlock_unlock(&rq->lock);
+  return proc;
+}
+
+//
+// send an IPI to hartid. M mode raises its software interrupt through the CLINT, and
+// forwards it as a supervisor software interrupt (see kernel/machine/mtrap.c).
+//
+static void send_ipi(int hartid) { mcall(MCALL_SEND_IPI, hartid); }
+
+//
+// work was queued on hart. wake the hart if it idles, or else an idle peer that can steal
+// the work.
+//
+static void sched_kick(int hart) {
+  int self = cpuid();
+  // the queued work must be visible before the idle flags are read (see sched_loop()).
+  mb();
+  if (run_queues[hart].idle) {
+    if (hart != self) send_ipi(hart);
+    return;
+  }
+  for (int i = 0; i < NCPU; i++)
+    if (i != self && run_queues[i].online && run_queues[i].idle) {
+      send_ipi(i);
+      return;
+    }
+}
+
+//
+// append proc to the tail of the run queue of hart.
+//
+static void enqueue(int hart, process* proc) {
+  rq_push(&run_queues[hart], proc);
+  sched_kick(hart);
+}
+
+//
+// make a process that has just been loaded runnable, on the run queue of the calling
+// hart. the idle harts steal it from there.
+//
+void insert_to_ready_queue(process* proc) {
+  spinlock_lock(&sched_lock);
+  nr_alive++;
+  spinlock_unlock(&sched_lock);
+  proc->hart = cpuid();
+  enqueue(proc->hart, proc);
+}
+
+//
+// take the oldest process of the hart with the longest run queue, or NULL.
+//
+static process* steal(void) {
+  int self = cpuid(), victim = -1, most = 0;
+  for (int i = 0; i < NCPU; i++)
+    if (i != self && run_queues[i].nr > most) {
+      victim = i;
+      most = run_queues[i].nr;
+    }
+  return victim < 0 ? NULL : rq_pop(&run_queues[victim]);
+}
+
+//
+// wait for a timer tick or an IPI with nothing to run. wfi returns once either is
+// pending, even though interrupts are disabled in S mode, and it is then handled here.
+//
+static void idle(void) {
+  asm volatile("wfi");
+  uint64 sip = read_csr(sip);
+  if (sip & MIP_SSIP) write_csr(sip, sip & ~MIP_SSIP);
+  if (sip & MIP_STIP) handle_timer_tick();
+}
+
+//
+// switch the hart to the kernel page table, and flush its TLB.
+//
+static void use_kernel_pagetable(void) {
+  write_csr(satp, MAKE_SATP(g_kernel_pagetable));
+  flush_tlb();
+}
+
+//
+// file the process the hart has left, now that nothing runs on its kernel stack.
+//
+static void put_prev(run_queue* rq) {
+  process* proc = rq->prev;
+  rq->prev = NULL;
+  if (proc == NULL) return;
+
+  // the kernel runs on the page table of the process it serves. the hart lets go of it
+  // (and of its TLB entries) before the process is visible to the other harts, which may
+  // run it, and free its page table once it exits or execs.
+  use_kernel_pagetable();
+
+  switch (proc->status) {
+    case READY:
+    case BLOCKED: {
+      // a blocked process is on the blocked list already (see sleep_retry()). it may have
+      // been woken since, it is then READY, and left for this hart to queue.
+      spinlock_lock(&sched_lock);
+      proc->on_cpu = 0;
+      int ready = proc->status == READY;
+      spinlock_unlock(&sched_lock);
+      if (ready) enqueue(cpuid(), proc);
+      break;
+    }
+    case ZOMBIE:
+      // free_process() is defined in kernel/process.c, it clears on_cpu.
+      free_process(proc);
+      break;
+    default:
+      panic("schedule: process in state %d left.\n", proc->status);
+  }
+}
+
+//
+// the scheduler loop of the hart, entered on its scheduler stack.
+//
+static void __attribute__((noreturn)) sched_loop(void) {
+  run_queue* rq = &run_queues[cpuid()];
+  put_prev(rq);
+
+  process* next;
+  while (1) {
+    if ((next = rq_pop(rq)) || (next = steal())) break;
+    rq->idle = 1;
+    mb();
+    // check again: work queued before the flag was seen sends no IPI.
+    if ((next = rq_pop(rq)) || (next = steal())) {
+      rq->idle = 0;
+      break;
+    }
+    idle();
+    rq->idle = 0;
+  }
+
+  // the hart runs on the kernel page table here, return_to_user() switches to the one of
+  // next (and flushes the TLB).
+  next->hart = cpuid();
+  next->ticks_left = SCHED_TIME_SLICE;
+  next->on_cpu = 1;
+  // switch_to() is defined in kernel/process.c, it does not return.
+  switch_to(next);
+  panic("schedule: switch_to returned.\n");
+}
+
+//
+// leave the current process (if any) in the state it has been given, and switch to the
+// next runnable one, idling until there is one.
+//
+void schedule() {
+  int hartid = cpuid();
+  run_queues[hartid].prev = current;
+  current = NULL;
+  // continue on the scheduler stack of the hart. nothing is kept on the old stack.
+  asm volatile("mv sp, %0\n\tjr %1" ::"r"(&sched_stacks[hartid][2 * PGSIZE]), "r"(sched_loop));
+  __builtin_unreachable();
+}
+
+//
+// the calling hart has finished its initialization and takes part in scheduling.
+//
+void sched_join(void) { run_queues[cpuid()].online = 1; }
+
+//
+// account a timer tick to the current process, and preempt it at the end of its slice.
+//
+void sched_tick(void) {
+  if (current == NULL || current->status != RUNNING) return;
+  if (--current->ticks_left > 0) return;
+
+  if (run_queues[cpuid()].nr == 0) {
+    // nobody else wants the hart: start a new slice.
+    current->ticks_left = SCHED_TIME_SLICE;
+    return;
+  }
+  current->status = READY;
+  schedule();
+}
+
+//
+// the current process exits with code. the system shuts down when it was the last one.
+// otherwise, the caller leaves the process (a ZOMBIE now) with schedule().
+//
+void sched_exit(int code) {
+  // exit_process() is defined in kernel/process.c
+  exit_process(current, code);
+  spinlock_lock(&sched_lock);
+  int last = --nr_alive == 0;
+  spinlock_unlock(&sched_lock);
+  if (last) shutdown(code);
+}
+
+//
+// block the current process on chan until wakeup(chan). the syscall being served is
+// restarted (the ecall executes again) when the process runs next, the caller leaves the
+// process with schedule() once the syscall has returned. the process is on the blocked
+// list from here on, a wakeup() that comes before its hart has left it makes it READY
+// again. one that comes between the check of the caller and this call is missed, unless
+// the caller holds a lock the waker takes (see wait_process() in kernel/process.c); the
+// console wakes its readers at every tick while input is waiting (see file_console_poll()).
+//
+void sleep_retry(void* chan) {
+  process* proc = current;
+  // the syscall entry (kernel/strap_vector.S) has moved epc past the ecall already.
+  proc->trapframe->epc -= 4;
+  spinlock_lock(&sched_lock);
+  proc->wait_chan = chan;
+  proc->status = BLOCKED;
+  proc->queue_next = blocked_queue_head;
+  blocked_queue_head = proc;
+  spinlock_unlock(&sched_lock);
+}
+
+//
+// make the processes blocked on chan ready, on the run queues of the harts they ran on.
+// those still on their harts are queued when the harts leave them.
+//
+void wakeup(void* chan) {
+  process* woken = NULL;
+  spinlock_lock(&sched_lock);
+  process** link = &blocked_queue_head;
+  while (*link) {
+    process* proc = *link;
+    if (proc->wait_chan != chan) {
+      link = &proc->queue_next;
+      continue;
+    }
+    *link = proc->queue_next;
+    proc->wait_chan = NULL;
+    proc->status = READY;
+    if (proc->on_cpu) continue;
+    proc->queue_next = woken;
+    woken = proc;
+  }
+  spinlock_unlock(&sched_lock);
+
+  while (woken) {
+    process* proc = woken;
+    woken = proc->queue_next;
+    enqueue(proc->hart, proc);
+  }
+}
@@ -0,0 +1,14 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include "process.h"
+
+void insert_to_ready_queue(process* proc);
+void sched_join(void);
+void schedule() __attribute__((noreturn));
+void sched_tick(void);
+void sched_exit(int code);
+void sleep_retry(void* chan);
+void wakeup(void* chan);
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * Slab allocator for the small, fixed-size objects of the kernel (processes, trapframes,
+ * VMAs, ...), built on top of the buddy page allocator (kernel/pmm.c).
+ *
+ * a cache keeps the objects of one type in slabs, i.e., blocks of 2^slab_order pages
+ * carved into cache-line aligned slots. the optional constructor runs once when a slab is
+ * created, and objects are expected to be freed in their constructed state, so the link of
+ * the free list is kept in a word behind each object rather than on top of it.
+ *
+ * in front of the slabs, every hart has a magazine of free objects. the common alloc/free
+ * path only touches the magazine of the current hart and takes no lock. the cache lock is
+ * taken when a magazine runs empty (refilled with half a magazine) or full (half flushed).
+ */
+
+#include "slab.h"
+#include "pmm.h"
+#include "riscv.h"
+#include "string.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+// header of a slab, placed at its beginning.
+typedef struct kmem_slab_t {
+  struct kmem_slab_t *next, *prev;  // links in the full/partial/empty list of its cache
+  kmem_cache *cache;
+  void *free;    // first free object of the slab
+  uint32 inuse;  // objects of the slab that are not free
+} kmem_slab;
+
+// the free-list link stored in the last word of an object slot.
+#define OBJ_LINK(cache, obj) (*(void **)((char *)(obj) + (cache)->slot_size - sizeof(void *)))
+
+static kmem_cache caches[KMEM_MAX_CACHES];
+static int nr_caches;
+static spinlock_t caches_lock = SPINLOCK_INIT;
+
+static void slab_list_add(kmem_slab **head, kmem_slab *s) {
+  s->prev = NULL;
+  s->next = *head;
+  if (*head) (*head)->prev = s;
+  *head = s;
+}
+
+static void slab_list_del(kmem_slab **head, kmem_slab *s) {
+  if (s->prev)
+    s->prev->next = s->next;
+  else
+    *head = s->next;
+  if (s->next) s->next->prev = s->prev;
+}
+
+//
+// create a slab for cache, construct its objects and put it into the empty list.
+//
+static kmem_slab *slab_create(kmem_cache *cache) {
+  void *pa = alloc_pages(cache->slab_order);
+  if (pa == NULL) return NULL;
+
+  // the page descriptors lead kmem_cache_free() back to the slab.
+  for (int i = 0; i < (1 << cache->slab_order); i++)
+    pa_to_page(pa + ((uint64)i << PGSHIFT))->slab = pa;
+
+  kmem_slab *s = (kmem_slab *)pa;
+  s->cache = cache;
+  s->inuse = 0;
+  s->free = NULL;
+  for (int i = cache->per_slab - 1; i >= 0; i--) {
+    void *obj = pa + cache->first_obj + i * cache->slot_size;
+    if (cache->ctor) cache->ctor(obj);
+    OBJ_LINK(cache, obj) = s->free;
+    s->free = obj;
+  }
+
+  slab_list_add(&cache->empty, s);
+  cache->nr_slabs++;
+  return s;
+}
+
+static void slab_destroy(kmem_cache *cache, kmem_slab *s) {
+  slab_list_del(&cache->empty, s);
+  cache->nr_slabs--;
+  for (int i = 0; i < (1 << cache->slab_order); i++)
+    pa_to_page((void *)s + ((uint64)i << PGSHIFT))->slab = NULL;
+  free_pages(s, cache->slab_order);
+}
+
+//
+// take one object out of the slabs of cache. the cache lock must be held.
+//
+static void *slab_get(kmem_cache *cache) {
+  kmem_slab *s = cache->partial;
+  kmem_slab **from = &cache->partial;
+  if (s == NULL) {
+    if (cache->empty == NULL && slab_create(cache) == NULL) return NULL;
+    s = cache->empty;
+    from = &cache->empty;
+  }
+
+  void *obj = s->free;
+  s->free = OBJ_LINK(cache, obj);
+  s->inuse++;
+  cache->nr_inuse++;
+
+  slab_list_del(from, s);
+  slab_list_add(s->inuse == cache->per_slab ? &cache->full : &cache->partial, s);
+  return obj;
+}
+
+//
+// give one object back to its slab. the cache lock must be held. one empty slab is kept
+// for the next allocations, further empty slabs are returned to the page allocator.
+//
+static void slab_put(kmem_cache *cache, void *obj) {
+  kmem_slab *s = (kmem_slab *)pa_to_page((void *)ROUNDDOWN((uint64)obj, PGSIZE))->slab;
+  if (s == NULL || s->cache != cache) panic("kmem_cache_free: %p is not from cache %s.\n", obj,
+                                            cache->name);
+
+  slab_list_del(s->inuse == cache->per_slab ? &cache->full : &cache->partial, s);
+  OBJ_LINK(cache, obj) = s->free;
+  s->free = obj;
+  s->inuse--;
+  cache->nr_inuse--;
+
+  if (s->inuse > 0) {
+    slab_list_add(&cache->partial, s);
+  } else {
+    slab_list_add(&cache->empty, s);
+    if (s->next) slab_destroy(cache, s->next);
+  }
+}
+
+//
+// create a cache for objects of size bytes, aligned to align bytes (at least a cache
+// line). ctor (optional) constructs the objects when their slab is created.
+//
+kmem_cache *kmem_cache_create(const char *name, uint64 size, uint64 align, void (*ctor)(void *)) {
+  spinlock_lock(&caches_lock);
+  if (nr_caches == KMEM_MAX_CACHES) panic("kmem_cache_create: too many caches.\n");
+  kmem_cache *cache = &caches[nr_caches++];
+  spinlock_unlock(&caches_lock);
+
+  memset(cache, 0, sizeof(kmem_cache));
+  align = MAX(align, KMEM_CACHE_LINE);
+  cache->name = name;
+  cache->obj_size = size;
+  cache->slot_size = ROUNDUP(size + sizeof(void *), align);
+  cache->first_obj = ROUNDUP(sizeof(kmem_slab), align);
+  cache->ctor = ctor;
+
+  // use the smallest slab (up to 8 pages) that holds at least 8 objects.
+  for (cache->slab_order = 0;; cache->slab_order++) {
+    cache->per_slab = ((PGSIZE << cache->slab_order) - cache->first_obj) / cache->slot_size;
+    if (cache->per_slab >= 8 || cache->slab_order == 3) break;
+  }
+  if (cache->per_slab == 0) panic("kmem_cache_create: objects of %s are too large.\n", name);
+
+  return cache;
+}
+
+//
+// allocate an object from cache. returns NULL if out of memory.
+//
+void *kmem_cache_alloc(kmem_cache *cache) {
+  kmem_magazine *mag = &cache->mags[cpuid()];
+  mag->allocs++;
+  if (likely(mag->count > 0)) {
+    mag->hits++;
+    return mag->objs[--mag->count];
+  }
+
+  // the magazine is empty: take one object for the caller, and refill half of it.
+  spinlock_lock(&cache->lock);
+  void *obj = slab_get(cache);
+  while (obj && mag->count < KMEM_MAGAZINE_SIZE / 2) {
+    void *extra = slab_get(cache);
+    if (extra == NULL) break;
+    mag->objs[mag->count++] = extra;
+  }
+  spinlock_unlock(&cache->lock);
+
+  return obj;
+}
+
+//
+// free an object (in its constructed state) to cache.
+//
+void kmem_cache_free(kmem_cache *cache, void *obj) {
+  kmem_magazine *mag = &cache->mags[cpuid()];
+  mag->frees++;
+  if (likely(mag->count < KMEM_MAGAZINE_SIZE)) {
+    mag->hits++;
+    mag->objs[mag->count++] = obj;
+    return;
+  }
+
+  // the magazine is full: give the object and half of the magazine back to the slabs.
+  spinlock_lock(&cache->lock);
+  slab_put(cache, obj);
+  while (mag->count > KMEM_MAGAZINE_SIZE / 2) slab_put(cache, mag->objs[--mag->count]);
+  spinlock_unlock(&cache->lock);
+}
+
+//
+// collect the usage counters of cache.
+//
+void kmem_cache_stats(kmem_cache *cache, kmem_stats *stats) {
+  memset(stats, 0, sizeof(kmem_stats));
+  for (int i = 0; i < NCPU; i++) {
+    stats->allocs += cache->mags[i].allocs;
+    stats->frees += cache->mags[i].frees;
+    stats->magazine_hits += cache->mags[i].hits;
+  }
+
+  spinlock_lock(&cache->lock);
+  for (kmem_slab *s = cache->full; s; s = s->next) stats->full++;
+  for (kmem_slab *s = cache->partial; s; s = s->next) stats->partial++;
+  stats->slabs = cache->nr_slabs;
+  stats->objs = cache->nr_slabs * cache->per_slab;
+  stats->inuse = cache->nr_inuse;
+  spinlock_unlock(&cache->lock);
+}
+
+//
+// print the counters of all caches.
+//
+void kmem_cache_dump(void) {
+  sprint("slab cache       objsize  inuse/objs  slabs(full/partial)  allocs  frees  mag hits\n");
+  for (int i = 0; i < nr_caches; i++) {
+    kmem_stats st;
+    kmem_cache_stats(&caches[i], &st);
+    sprint("%s: %ld %ld/%ld %ld(%ld/%ld) %ld %ld %ld\n", caches[i].name, caches[i].obj_size, st.inuse,
+           st.objs, st.slabs, st.full, st.partial, st.allocs, st.frees, st.magazine_hits);
+  }
+}
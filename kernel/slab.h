@@ -0,0 +1,59 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include "util/types.h"
+#include "config.h"
+#include "spike_interface/atomic.h"
+
+// objects are aligned to (at least) the size of a cache line.
+#define KMEM_CACHE_LINE 64
+// number of objects a per-hart magazine holds.
+#define KMEM_MAGAZINE_SIZE 16
+// maximum number of caches.
+#define KMEM_MAX_CACHES 16
+
+struct kmem_slab_t;
+
+// a per-hart stack of free objects. allocations and frees of a hart are served from its
+// magazine without taking the cache lock, as long as the magazine is neither empty nor full.
+typedef struct kmem_magazine_t {
+  int count;
+  void *objs[KMEM_MAGAZINE_SIZE];
+  // counters of the hart, kept here so that they are updated without locking.
+  uint64 allocs, frees, hits;
+} kmem_magazine;
+
+// usage counters of a cache.
+typedef struct kmem_stats_t {
+  uint64 allocs, frees;     // calls of kmem_cache_alloc() / kmem_cache_free()
+  uint64 magazine_hits;     // calls served by the per-hart magazines
+  uint64 slabs;             // slabs owned by the cache
+  uint64 full, partial;     // slabs with all / some objects in use (the rest are empty)
+  uint64 objs, inuse;       // object slots, and slots not free in the slabs
+} kmem_stats;
+
+// a cache of objects of one type and size.
+typedef struct kmem_cache_t {
+  const char *name;
+  uint64 obj_size;   // size of the objects, as requested
+  uint64 slot_size;  // size of an object slot in a slab (object + free-list link, aligned)
+  int slab_order;    // a slab is a block of 2^slab_order pages
+  int per_slab;      // objects per slab
+  uint64 first_obj;  // offset of the first object in a slab
+  void (*ctor)(void *);
+
+  spinlock_t lock;   // protects the slab lists and the counters below
+  // lists of slabs that are full, partially used and empty.
+  struct kmem_slab_t *full, *partial, *empty;
+  uint64 nr_slabs, nr_inuse;
+
+  kmem_magazine mags[NCPU];
+} kmem_cache;
+
+kmem_cache *kmem_cache_create(const char *name, uint64 size, uint64 align, void (*ctor)(void *));
+void *kmem_cache_alloc(kmem_cache *cache);
+void kmem_cache_free(kmem_cache *cache, void *obj);
+void kmem_cache_stats(kmem_cache *cache, kmem_stats *stats);
+void kmem_cache_dump(void);
+
+#endif
@@ -6,24 +6,83 @@
 #include "process.h"
 #include "strap.h"
 #include "syscall.h"
+#include "vma.h"
+#include "sched.h"
+#include "file.h"
+#include "machine/mtrap.h"
 
 #include "spike_interface/spike_utils.h"
 
 //
-// handling the syscalls. will call do_syscall() defined in kernel/syscall.c
+// handling the syscalls, called by the fast path of kernel/strap_vector.S with the
+// trapframe of current. tf->epc points past the ecall already. will call do_syscall()
+// defined in kernel/syscall.c
 //
-static void handle_syscall(trapframe *tf) {
-  // tf->epc points to the address that our computer will jump to after the trap handling.
-  // for a syscall, we should return to the NEXT instruction after its handling.
-  // in RV64G, each instruction occupies exactly 32 bits (i.e., 4 Bytes)
-  tf->epc += 4;
+// the trapframe holds only the registers the C code may change. returns 0 to resume the
+// process right away, or 1 if it has left the RUNNING state (it blocks or exits) or the
+// syscall needs all the registers: the trap vector then completes the trapframe and calls
+// smode_syscall_leave().
+//
+long smode_syscall_handler(trapframe *tf) {
+  // fork and exec need the complete trapframe, they are served in smode_syscall_leave().
+  if (syscall_flags(tf->regs.a0) & SYSCALL_FULL_FRAME) return 1;
+
+  long ret = do_syscall(tf->regs.a0, tf->regs.a1, tf->regs.a2, tf->regs.a3, tf->regs.a4,
+                        tf->regs.a5, tf->regs.a6, tf->regs.a7);
+  // a blocked syscall runs again with its arguments, a0 is left alone.
+  if (current->status != RUNNING) return 1;
 
-  // TODO (lab1_1): remove the panic call below, and call do_syscall (defined in
-  // kernel/syscall.c) to conduct real operations of the kernel side for a syscall.
   // IMPORTANT: return value should be returned to user app, or else, you will encounter
   // problems in later experiments!
-  //panic( "call do_syscall to accomplish the syscall and lab1_1 here.\n" );
-  do_syscall(tf->regs.a0, tf->regs.a1, tf->regs.a2, tf->regs.a3, tf->regs.a4, tf->regs.a5, tf->regs.a6, tf->regs.a7);
+  tf->regs.a0 = ret;
+  return 0;
+}
+
+//
+// the long way out of a syscall, with the complete trapframe of current. the syscalls
+// flagged SYSCALL_FULL_FRAME (see kernel/syscall_table.h) are served here.
+//
+void smode_syscall_leave(void) {
+  trapframe *tf = current->trapframe;
+  if (current->status == RUNNING && (syscall_flags(tf->regs.a0) & SYSCALL_FULL_FRAME)) {
+    long ret = do_syscall(tf->regs.a0, tf->regs.a1, tf->regs.a2, tf->regs.a3, tf->regs.a4,
+                          tf->regs.a5, tf->regs.a6, tf->regs.a7);
+    if (current->status == RUNNING) tf->regs.a0 = ret;
+  }
+
+  // schedule() is defined in kernel/sched.c
+  if (current->status != RUNNING) schedule();
+  switch_to(current);
+}
+
+//
+// the page fault handler. user pages are populated on demand: the first access to a page
+// of a VMA faults, and vma_fault() (defined in kernel/vma.c) fills and maps the page.
+//
+void handle_user_page_fault(uint64 mcause, uint64 sepc, uint64 stval) {
+  if (vma_fault(current, stval, mcause) != 0) {
+    sprint("handle_user_page_fault: illegal access to 0x%lx (scause %p, sepc %p)\n", stval,
+           mcause, sepc);
+    panic("unexpected page fault.\n");
+  }
+}
+
+// number of timer ticks since boot
+static uint64 g_ticks = 0;
+
+//
+// a timer tick, forwarded by M mode (see kernel/machine/mtrap.c) as a supervisor timer
+// interrupt. S mode cannot clear the pending interrupt itself, it asks M mode to.
+//
+void handle_timer_tick(void) {
+  g_ticks++;
+  mcall(MCALL_TIMER_ACK, 0);
+
+  // kernel messages waiting in the log ring go out at least once per tick.
+  klog_flush();
+  // service the HTIF, and wake the readers of console input that has arrived.
+  // file_console_poll() is defined in kernel/file.c
+  file_console_poll();
 }
 
 //
@@ -41,8 +100,21 @@ void smode_trap_handler(void) {
 
   // if the cause of trap is syscall from user application.
   // read_csr() and CAUSE_USER_ECALL are macros defined in kernel/riscv.h
-  if (read_csr(scause) == CAUSE_USER_ECALL) {
-    handle_syscall(current->trapframe);
+  uint64 cause = read_csr(scause);
+  // compiled out unless KLOG_LEVEL is raised to LOG_DEBUG (see spike_interface/spike_log.h).
+  klog_debug("trap: scause %lx sepc %lx stval %lx\n", cause, read_csr(sepc), read_csr(stval));
+  // syscalls do not come here, see smode_syscall_handler() above.
+  if (cause == CAUSE_LOAD_PAGE_FAULT || cause == CAUSE_STORE_PAGE_FAULT ||
+             cause == CAUSE_FETCH_PAGE_FAULT) {
+    handle_user_page_fault(cause, read_csr(sepc), read_csr(stval));
+  } else if (cause == CAUSE_STIMER) {
+    handle_timer_tick();
+    // switches to another process when the time slice of current is used up.
+    // sched_tick() is defined in kernel/sched.c
+    sched_tick();
+  } else if (cause == CAUSE_SSOFT) {
+    // an IPI (see sched_kick() in kernel/sched.c) that came after the hart found work.
+    write_csr(sip, read_csr(sip) & ~MIP_SSIP);
   } else {
     sprint("smode_trap_handler(): unexpected scause %p\n", read_csr(scause));
     sprint("            sepc=%p stval=%p\n", read_csr(sepc), read_csr(stval));
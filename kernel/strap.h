@@ -1,6 +1,14 @@
 #ifndef _STRAP_H_
 #define _STRAP_H_
 
+#include "util/types.h"
+
+struct trapframe_t;
+
 void smode_trap_handler(void);
+long smode_syscall_handler(struct trapframe_t *tf);
+void smode_syscall_leave(void) __attribute__((noreturn));
+void handle_user_page_fault(uint64 mcause, uint64 sepc, uint64 stval);
+void handle_timer_tick(void);
 
 #endif
@@ -1,5 +1,10 @@
 /*
  * contains the implementation of all syscalls.
+ *
+ * the syscalls are dispatched through a table indexed by their number (from
+ * SYS_user_base, see kernel/syscall_table.h). every handler returns a 64-bit value, and
+ * reports failures as negative errno values. user buffers are checked to lie in user
+ * space before they are touched (see user_range_ok() in kernel/vma.c).
  */
 
 #include <stdint.h>
@@ -9,39 +14,418 @@
 #include "syscall.h"
 #include "string.h"
 #include "process.h"
+#include "vmm.h"
+#include "vma.h"
+#include "memlayout.h"
+#include "sched.h"
 #include "util/functions.h"
 
 #include "spike_interface/spike_utils.h"
 
 //
-// implement the SYS_user_print syscall
+// the open file behind descriptor fd of the current process, or NULL.
 //
-ssize_t sys_user_print(const char* buf, size_t n) {
-  sprint(buf);
-  return 0;
+static kfile* fd_file(int fd) {
+  if (fd < 0 || fd >= NOFILE) return NULL;
+  return current->ofile[fd];
+}
+
+//
+// install f at the lowest free descriptor of the current process. returns the descriptor,
+// or -EMFILE if the table is full.
+//
+static int fd_alloc(kfile* f) {
+  for (int fd = 0; fd < NOFILE; fd++)
+    if (current->ofile[fd] == NULL) {
+      current->ofile[fd] = f;
+      return fd;
+    }
+  return -EMFILE;
+}
+
+//
+// read (to_user) or write n bytes between the file f at offset off and the user buffer at
+// va. the user buffer is handed to the file as it is, without copying: it is translated
+// page by page (the kernel direct-maps the physical memory), and every run of physically
+// contiguous pages is passed in one call. returns the number of bytes moved (0 at the end
+// of a file), -EAGAIN if the file has nothing to read yet, -EFAULT for a bad buffer, or
+// -EIO.
+//
+// a file with a user_io operation (a host file) may put the process to sleep for the first
+// call if may_sleep is set, -EINPROGRESS is returned then. the syscall runs again once the
+// process is woken up. the calls after the first one do not sleep, they wait for the host
+// in place.
+//
+static long file_user_io(kfile* f, uint64 va, size_t n, uint64 off, int to_user,
+                         int may_sleep) {
+  if (!user_range_ok(va, n)) return -EFAULT;
+
+  size_t done = 0;
+  while (done < n) {
+    // vma_va_to_pa() populates the pages that have not been touched yet.
+    char* pa = (char*)vma_va_to_pa(current, va + done, to_user);
+    if (pa == NULL) return done ? done : -EFAULT;
+    size_t len = MIN(n - done, PGSIZE - ((va + done) & (PGSIZE - 1)));
+
+    // extend the chunk over the following pages as long as they are contiguous.
+    while (done + len < n) {
+      char* next = (char*)vma_va_to_pa(current, va + done + len, to_user);
+      if (next != pa + len) break;
+      len += MIN(n - done - len, PGSIZE);
+    }
+
+    ssize_t r;
+    if (f->ops->user_io)
+      r = f->ops->user_io(f, pa, len, off + done, !to_user, may_sleep && done == 0);
+    else
+      r = to_user ? f->ops->read(f, pa, len, off + done)
+                  : f->ops->write(f, pa, len, off + done);
+    if (r == -EINPROGRESS) return r;
+    if (r < 0) return done ? done : (r == -EAGAIN ? r : -EIO);
+    done += r;
+    if (r < len) break;
+  }
+  return done;
+}
+
+//
+// write n bytes of buf at the position of the file fd (at its end with O_APPEND). the
+// process may sleep on the file if may_sleep is set, see file_user_io().
+//
+static long file_write(int fd, const char* buf, size_t n, int may_sleep) {
+  kfile* f = fd_file(fd);
+  if (f == NULL || (f->flags & O_ACCMODE) == O_RDONLY) return -EBADF;
+
+  uint64 off = f->pos;
+  if (f->seekable && (f->flags & O_APPEND)) {
+    struct file_stat st;
+    if (f->ops->stat(f, &st) != 0) return -EIO;
+    off = st.size;
+  }
+
+  long r = file_user_io(f, (uint64)buf, n, off, 0, may_sleep);
+  if (r > 0 && f->seekable) f->pos = off + r;
+  return r;
+}
+
+//
+// implement the SYS_user_write syscall. writes n bytes of buf at the position of the file
+// fd (at its end with O_APPEND). returns the number of bytes written.
+//
+long sys_user_write(int fd, const char* buf, size_t n) { return file_write(fd, buf, n, 1); }
+
+//
+// implement the SYS_user_read syscall. reads at most n bytes at the position of the file
+// fd into buf. returns the number of bytes read (0 at the end of the file).
+//
+long sys_user_read(int fd, char* buf, size_t n) {
+  kfile* f = fd_file(fd);
+  if (f == NULL || (f->flags & O_ACCMODE) == O_WRONLY) return -EBADF;
+
+  long r = file_user_io(f, (uint64)buf, n, f->pos, 1, 1);
+  // nothing to read yet (console input): sleep on the file, and run the syscall again
+  // once woken up. sleep_retry() is defined in kernel/sched.c
+  if (r == -EAGAIN) {
+    sleep_retry(f);
+    return r;
+  }
+  if (r > 0 && f->seekable) f->pos += r;
+  return r;
+}
+
+//
+// implement the SYS_user_pread syscall: read at offset off of the file fd, leaving its
+// position alone. only seekable files support it.
+//
+long sys_user_pread(int fd, char* buf, size_t n, uint64 off) {
+  kfile* f = fd_file(fd);
+  if (f == NULL || (f->flags & O_ACCMODE) == O_WRONLY) return -EBADF;
+  if (!f->seekable) return -ESPIPE;
+
+  return file_user_io(f, (uint64)buf, n, off, 1, 1);
+}
+
+//
+// implement the SYS_user_writev syscall: write the iovcnt segments described by the user
+// array iov in one trap. returns the number of bytes written.
+//
+long sys_user_writev(int fd, const struct iovec* iov, int iovcnt) {
+  if (iovcnt < 0 || iovcnt > IOV_MAX || ((uint64)iov % sizeof(uint64)) != 0) return -EINVAL;
+  if (!user_range_ok((uint64)iov, iovcnt * sizeof(struct iovec))) return -EFAULT;
+
+  long total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    // both (aligned) words of a segment lie within a page, translate them one by one.
+    uint64* base = (uint64*)vma_va_to_pa(current, (uint64)&iov[i].iov_base, 0);
+    uint64* len = (uint64*)vma_va_to_pa(current, (uint64)&iov[i].iov_len, 0);
+    if (base == NULL || len == NULL) return total ? total : -EFAULT;
+    if (*len == 0) continue;
+
+    // only the first segment may sleep: the syscall runs again from the start then.
+    long r = file_write(fd, (const char*)*base, *len, total == 0);
+    if (r < 0) return total ? total : r;
+    total += r;
+    if (r < *len) break;
+  }
+  return total;
+}
+
+//
+// implement the SYS_user_print syscall, kept for old binaries: a write of n bytes of buf
+// to the standard output.
+//
+long sys_user_print(const char* buf, size_t n) {
+  long r = sys_user_write(1, buf, n);
+  return r < 0 ? r : (r == n ? 0 : -EIO);
 }
 
 //
 // implement the SYS_user_exit syscall
 //
-ssize_t sys_user_exit(uint64 code) {
+long sys_user_exit(uint64 code) {
   sprint("User exit with code:%d.\n", code);
-  // in lab1, PKE considers only one app (one process). 
-  // therefore, shutdown the system when the app calls exit()
-  shutdown(code);
+  // release the process, the next one runs once the syscall returns. the system shuts
+  // down when the last process exits. sched_exit() is defined in kernel/sched.c
+  sched_exit(code);
+  return 0;
+}
+
+//
+// implement the SYS_user_sbrk syscall: move the end of the heap by increment bytes (page
+// granular), and return the previous end. the new pages are populated on demand.
+//
+long sys_user_sbrk(long increment) {
+  uint64 old_brk = current->brk;
+  uint64 new_brk = old_brk + increment;
+
+  if ((increment > 0 && new_brk < old_brk) || new_brk < current->heap_start) return -EINVAL;
+  if (vma_resize(current, current->heap, new_brk) != 0) return -ENOMEM;
+  current->brk = new_brk;
+  return old_brk;
+}
+
+//
+// implement the SYS_user_mmap syscall. only anonymous mappings are supported, placed at
+// addr if that range is free, or else in the highest gap between the heap and the stack.
+//
+long sys_user_mmap(uint64 addr, uint64 length, int prot, int flags) {
+  if (length == 0 || !(flags & MAP_ANONYMOUS) || (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)))
+    return -EINVAL;
+  if (length > USER_SPACE_TOP) return -ENOMEM;
+  length = ROUNDUP(length, PGSIZE);
+
+  vm_area *vma = NULL;
+  if (addr && addr % PGSIZE == 0 && addr + length > addr)
+    vma = vma_add(current, addr, addr + length, prot, NULL, 0, 0, 0);
+  if (vma == NULL) {
+    addr = vma_find_gap(current, length, current->brk, USER_STACK_TOP - USER_STACK_SIZE);
+    if (addr == 0) return -ENOMEM;
+    vma = vma_add(current, addr, addr + length, prot, NULL, 0, 0, 0);
+    if (vma == NULL) return -ENOMEM;
+  }
+  return vma->start;
+}
+
+//
+// implement the SYS_user_munmap syscall. only whole areas created by sys_user_mmap can
+// be unmapped.
+//
+long sys_user_munmap(uint64 addr, uint64 length) {
+  vm_area *vma = vma_find(current, addr);
+  if (vma == NULL || vma == current->heap || vma->file || vma->start != addr ||
+      vma->end != ROUNDUP(addr + length, PGSIZE))
+    return -EINVAL;
+  vma_remove(current, vma);
+  return 0;
+}
+
+//
+// implement the SYS_user_open syscall: open the host file at the user string path.
+// returns the new descriptor.
+//
+long sys_user_open(const char* path, int flags, int mode) {
+  char kpath[256];
+  if (strncpy_from_user(current, kpath, (uint64)path, sizeof(kpath)) < 0) return -EFAULT;
+
+  kfile* f = file_open(kpath, flags, mode);
+  if (f == NULL) return -ENOENT;
+  int fd = fd_alloc(f);
+  if (fd < 0) file_put(f);
+  return fd;
+}
+
+//
+// implement the SYS_user_lseek syscall. returns the new position.
+//
+long sys_user_lseek(int fd, long offset, int whence) {
+  kfile* f = fd_file(fd);
+  if (f == NULL) return -EBADF;
+  if (!f->seekable) return -ESPIPE;
+
+  uint64 base;
+  switch (whence) {
+    case SEEK_SET:
+      base = 0;
+      break;
+    case SEEK_CUR:
+      base = f->pos;
+      break;
+    case SEEK_END: {
+      struct file_stat st;
+      if (f->ops->stat(f, &st) != 0) return -EIO;
+      base = st.size;
+      break;
+    }
+    default:
+      return -EINVAL;
+  }
+
+  if ((long)(base + offset) < 0) return -EINVAL;
+  f->pos = base + offset;
+  return f->pos;
+}
+
+//
+// implement the SYS_user_fstat syscall: fill the user struct file_stat at st.
+//
+long sys_user_fstat(int fd, struct file_stat* st) {
+  kfile* f = fd_file(fd);
+  struct file_stat kst;
+  if (f == NULL) return -EBADF;
+  if (f->ops->stat(f, &kst) != 0) return -EIO;
+  return copy_to_user(current, (uint64)st, &kst, sizeof(kst)) == 0 ? 0 : -EFAULT;
+}
+
+//
+// implement the SYS_user_close syscall.
+//
+long sys_user_close(int fd) {
+  kfile* f = fd_file(fd);
+  if (f == NULL) return -EBADF;
+  current->ofile[fd] = NULL;
+  file_put(f);
+  return 0;
+}
+
+//
+// implement the SYS_user_dup syscall: a new descriptor of the file of fd, sharing its
+// position. returns the new descriptor.
+//
+long sys_user_dup(int fd) {
+  kfile* f = fd_file(fd);
+  if (f == NULL) return -EBADF;
+  int nfd = fd_alloc(f);
+  if (nfd >= 0) file_get(f);
+  return nfd;
+}
+
+//
+// implement the SYS_user_fork syscall: a copy of the current process, which returns 0 from
+// the syscall. returns the pid of the child. the trapframe holds all the registers here
+// (see SYSCALL_FULL_FRAME in kernel/syscall_table.h).
+//
+long sys_user_fork(void) {
+  // fork_process() is defined in kernel/process.c
+  process* child = fork_process(current);
+  if (child == NULL) return -EAGAIN;
+  sprint("User fork: process %d forks process %d.\n", current->pid, child->pid);
+  int pid = child->pid;
+  // the child may run (and exit) on another hart at once.
+  insert_to_ready_queue(child);
+  return pid;
+}
+
+//
+// implement the SYS_user_exec syscall: run the program at the user string path in the
+// current process, from its entry. does not return to the old program on success.
+//
+long sys_user_exec(const char* path) {
+  char kpath[256];
+  if (strncpy_from_user(current, kpath, (uint64)path, sizeof(kpath)) < 0) return -EFAULT;
+  // exec_process() is defined in kernel/process.c
+  return exec_process(current, kpath) == 0 ? 0 : -ENOENT;
+}
+
+//
+// implement the SYS_user_wait syscall: wait for the child pid (any child if pid is -1) to
+// exit, and store its exit code at status (unless it is NULL). returns the pid of the
+// child.
+//
+long sys_user_wait(long pid, int* status) {
+  if (status && !user_range_ok((uint64)status, sizeof(int))) return -EFAULT;
+  int code;
+  // wait_process() is defined in kernel/process.c. 0 means the process sleeps, and the
+  // syscall is served again once a child exits.
+  long r = wait_process(current, pid, &code);
+  if (r < 0) return -ECHILD;
+  if (r > 0 && status && copy_to_user(current, (uint64)status, &code, sizeof(code)) != 0)
+    return -EFAULT;
+  return r;
+}
+
+//
+// implement the SYS_user_getpid syscall.
+//
+long sys_user_getpid(void) { return current->pid; }
+
+//
+// implement the SYS_user_nop syscall. it does nothing, but takes the path of the syscalls
+// that save all the registers (see kernel/syscall_table.h).
+//
+long sys_user_nop(void) { return 0; }
+
+// the arguments of a handler, from the raw registers: SYSCALL_ARGS_<nargs>(types...).
+#define SYSCALL_ARGS_0()
+#define SYSCALL_ARGS_1(t1) (t1)a1
+#define SYSCALL_ARGS_2(t1, t2) SYSCALL_ARGS_1(t1), (t2)a2
+#define SYSCALL_ARGS_3(t1, t2, t3) SYSCALL_ARGS_2(t1, t2), (t3)a3
+#define SYSCALL_ARGS_4(t1, t2, t3, t4) SYSCALL_ARGS_3(t1, t2, t3), (t4)a4
+#define SYSCALL_ARGS_5(t1, t2, t3, t4, t5) SYSCALL_ARGS_4(t1, t2, t3, t4), (t5)a5
+#define SYSCALL_ARGS_6(t1, t2, t3, t4, t5, t6) SYSCALL_ARGS_5(t1, t2, t3, t4, t5), (t6)a6
+
+// the table holds the handlers with a common type: each gets a wrapper that takes the six
+// argument registers as longs, and converts the ones of its syscall to the handler types.
+typedef long (*syscall_fn)(long, long, long, long, long, long);
+
+#define SYSCALL_WRAPPER(name, nr, nargs, flags, types)                                \
+  static long sys_wrap_##name(long a1, long a2, long a3, long a4, long a5, long a6) { \
+    return sys_user_##name(SYSCALL_ARGS_##nargs types);                               \
+  }
+SYSCALL_TABLE(SYSCALL_WRAPPER)
+#undef SYSCALL_WRAPPER
+
+typedef struct syscall_entry_t {
+  syscall_fn fn;
+  int flags;
+  const char* name;
+} syscall_entry;
+
+#define SYSCALL_ENTRY(name, nr, nargs, flags, types) \
+  [nr] = {sys_wrap_##name, flags, #name},
+static const syscall_entry syscall_table[] = {SYSCALL_TABLE(SYSCALL_ENTRY)};
+#undef SYSCALL_ENTRY
+
+#define NR_SYSCALLS (sizeof(syscall_table) / sizeof(syscall_table[0]))
+
+//
+// the flags of syscall number a0 in kernel/syscall_table.h (0 for an unknown number).
+//
+int syscall_flags(long a0) {
+  uint64 nr = a0 - SYS_user_base;
+  return nr < NR_SYSCALLS ? syscall_table[nr].flags : 0;
 }
 
 //
 // [a0]: the syscall number; [a1] ... [a7]: arguments to the syscalls.
-// returns the code of success, (e.g., 0 means success, fail for otherwise)
+// returns the result of the syscall, or a negative errno value (-ENOSYS for an unknown
+// syscall number). the arguments beyond the arity of the syscall are ignored.
 //
 long do_syscall(long a0, long a1, long a2, long a3, long a4, long a5, long a6, long a7) {
-  switch (a0) {
-    case SYS_user_print:
-      return sys_user_print((const char*)a1, a2);
-    case SYS_user_exit:
-      return sys_user_exit(a1);
-    default:
-      panic("Unknown syscall %ld \n", a0);
+  uint64 nr = a0 - SYS_user_base;
+  if (nr >= NR_SYSCALLS || syscall_table[nr].fn == NULL) {
+    klog_warn("unknown syscall %ld\n", a0);
+    return -ENOSYS;
   }
+
+  return syscall_table[nr].fn(a1, a2, a3, a4, a5, a6);
 }
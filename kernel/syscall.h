@@ -4,11 +4,58 @@
 #ifndef _SYSCALL_H_
 #define _SYSCALL_H_
 
-// syscalls of PKE OS kernel. append below if adding new syscalls.
+#include "syscall_table.h"
+
+// syscalls of PKE OS kernel, numbered from SYS_user_base. they are listed in
+// kernel/syscall_table.h, append there if adding new syscalls.
+//
+// a syscall returns a 64-bit value in a0. failures are reported as negative errno values
+// (-4095 ... -1), e.g., -ENOSYS for an unknown syscall number.
 #define SYS_user_base 64
-#define SYS_user_print (SYS_user_base + 0)
-#define SYS_user_exit (SYS_user_base + 1)
+#define SYSCALL_NUMBER(name, nr, nargs, flags, types) SYS_user_##name = SYS_user_base + (nr),
+enum syscall_number { SYSCALL_TABLE(SYSCALL_NUMBER) };
+#undef SYSCALL_NUMBER
+#define SYSCALL_ERRNO_MAX 4095
+
+// flags of SYS_user_mmap. only private anonymous mappings are supported.
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+
+// a segment of SYS_user_writev, shared by the kernel and the user library.
+struct iovec {
+  void *iov_base;
+  unsigned long iov_len;
+};
+// maximum number of segments of a SYS_user_writev.
+#define IOV_MAX 64
+
+// flags of SYS_user_open, passed on to the host for host files.
+#ifndef O_RDONLY
+#define O_RDONLY 00
+#define O_WRONLY 01
+#define O_RDWR 02
+#endif
+#define O_ACCMODE 03
+#define O_CREAT 0100
+#define O_TRUNC 01000
+#define O_APPEND 02000
+
+// whence of SYS_user_lseek
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+// the result of SYS_user_fstat. (the fields have no st_ prefix, which <sys/stat.h> may
+// turn into macros.)
+struct file_stat {
+  unsigned long dev, ino;
+  unsigned int mode, nlink;
+  unsigned long size;
+  unsigned long blksize, blocks;
+  unsigned long atime, mtime, ctime;
+};
 
 long do_syscall(long a0, long a1, long a2, long a3, long a4, long a5, long a6, long a7);
+int syscall_flags(long a0);
 
 #endif
@@ -0,0 +1,43 @@
+/*
+ * the table of syscalls, shared by the kernel (the dispatch table of kernel/syscall.c) and
+ * the user library.
+ *
+ * X(name, nr, nargs, flags, (types)): syscall SYS_user_<name> is number SYS_user_base + nr,
+ * and takes nargs arguments (in a1 ... a6) of the listed types. the kernel handler is
+ * sys_user_<name>(), with those parameters. append below if adding new syscalls.
+ *
+ * flags is 0 or SYSCALL_FULL_FRAME. the syscall entry saves only the registers the C code
+ * may clobber (see kernel/strap_vector.S); a syscall that copies or replaces the whole user
+ * context (fork, exec) is served once all the registers are in the trapframe. nop does
+ * nothing on that path, for user/app_syscall_bench.c to compare it with the fast one.
+ */
+#ifndef _SYSCALL_TABLE_H_
+#define _SYSCALL_TABLE_H_
+
+#define SYSCALL_FULL_FRAME 1
+
+#define SYSCALL_TABLE(X)                              \
+  X(print, 0, 2, 0, (const char*, size_t))            \
+  X(exit, 1, 1, 0, (uint64))                          \
+  X(sbrk, 2, 1, 0, (long))                            \
+  X(mmap, 3, 4, 0, (uint64, uint64, int, int))        \
+  X(munmap, 4, 2, 0, (uint64, uint64))                \
+  X(write, 5, 3, 0, (int, const char*, size_t))       \
+  X(writev, 6, 3, 0, (int, const struct iovec*, int)) \
+  X(open, 7, 3, 0, (const char*, int, int))           \
+  X(read, 8, 3, 0, (int, char*, size_t))              \
+  X(pread, 9, 4, 0, (int, char*, size_t, uint64))     \
+  X(lseek, 10, 3, 0, (int, long, int))                \
+  X(fstat, 11, 2, 0, (int, struct file_stat*))        \
+  X(close, 12, 1, 0, (int))                           \
+  X(dup, 13, 1, 0, (int))                             \
+  X(fork, 14, 0, SYSCALL_FULL_FRAME, ())              \
+  X(exec, 15, 1, SYSCALL_FULL_FRAME, (const char*))   \
+  X(wait, 16, 2, 0, (long, int*))                     \
+  X(getpid, 17, 0, 0, ())                             \
+  X(nop, 18, 0, SYSCALL_FULL_FRAME, ())
+
+// syscalls take at most this many arguments.
+#define SYSCALL_MAX_ARGS 6
+
+#endif
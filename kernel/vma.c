@@ -0,0 +1,337 @@
+/*
+ * virtual memory areas (VMAs) of user processes, and demand paging on top of them.
+ *
+ * the ELF loader registers each segment as a VMA backed by the elf file instead of
+ * reading it. a page of the area is allocated and filled on the first page fault that
+ * touches it, so the startup cost of an application scales with the pages it uses.
+ * only the file part (filesz) of a segment is read from the file; pages of zeros (bss)
+ * share one read-only zero page until they are written.
+ *
+ * fork shares the populated pages between the parent and the child, mapped read-only in
+ * both. the first store to such a page copies it, or takes it back writable if the other
+ * mappings are gone already.
+ */
+
+#include "vma.h"
+#include "process.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "memlayout.h"
+#include "slab.h"
+#include "file.h"
+#include "riscv.h"
+#include "string.h"
+#include "util/functions.h"
+#include "spike_interface/spike_utils.h"
+
+// VMAs are allocated from a slab cache (see kernel/slab.c)
+static kmem_cache *vma_cache;
+
+void vma_init(void) { vma_cache = kmem_cache_create("vm_area", sizeof(vm_area), 0, NULL); }
+
+// does [start, end) overlap an area of p other than "except"?
+static int vma_overlaps(process *p, uint64 start, uint64 end, vm_area *except) {
+  for (vm_area *v = p->vmas; v; v = v->next)
+    if (v != except && start < v->end && v->start < end) return 1;
+  return 0;
+}
+
+//
+// register the VMA [start, end) with permissions prot to process p. for a file-backed
+// area, [data_start, data_end) is read from file at file_off. an empty area (start ==
+// end) is allowed, it can be grown later by vma_resize(). returns the new area, or NULL
+// if the range is invalid or overlaps an existing area.
+//
+vm_area *vma_add(process *p, uint64 start, uint64 end, int prot, kfile *file,
+                 uint64 file_off, uint64 data_start, uint64 data_end) {
+  start = ROUNDDOWN(start, PGSIZE);
+  end = ROUNDUP(end, PGSIZE);
+  if (start > end || end > USER_SPACE_TOP) return NULL;
+
+  // areas never overlap, each page belongs to at most one area.
+  if (vma_overlaps(p, start, end, NULL)) return NULL;
+
+  vm_area *vma = (vm_area *)kmem_cache_alloc(vma_cache);
+  if (vma == NULL) return NULL;
+  vma->start = start;
+  vma->end = end;
+  vma->prot = prot;
+  vma->file = file;
+  vma->file_off = file_off;
+  vma->data_start = data_start;
+  vma->data_end = data_end;
+  vma->next = p->vmas;
+  p->vmas = vma;
+
+  // the area holds a reference to its backing file. file_get() is defined in kernel/file.c
+  if (file) file_get(file);
+  return vma;
+}
+
+//
+// move the end of vma to new_end (rounded up to a page). the pages beyond a shrunk end
+// are unmapped and freed. returns 0 on success, -1 if the area would overlap another.
+//
+int vma_resize(process *p, vm_area *vma, uint64 new_end) {
+  new_end = ROUNDUP(new_end, PGSIZE);
+  if (new_end < vma->start || new_end > USER_SPACE_TOP) return -1;
+
+  if (new_end > vma->end) {
+    if (vma_overlaps(p, vma->end, new_end, vma)) return -1;
+  } else if (new_end < vma->end) {
+    user_vm_unmap(p->pagetable, new_end, vma->end - new_end, 1);
+  }
+  vma->end = new_end;
+  return 0;
+}
+
+//
+// remove vma from process p, unmapping and freeing its pages.
+//
+void vma_remove(process *p, vm_area *vma) {
+  vm_area **link = &p->vmas;
+  while (*link != vma) link = &(*link)->next;
+  *link = vma->next;
+
+  if (vma->end > vma->start) user_vm_unmap(p->pagetable, vma->start, vma->end - vma->start, 1);
+  if (vma->file) file_put(vma->file);
+  kmem_cache_free(vma_cache, vma);
+}
+
+//
+// the level-0 PTE of the (page aligned) user va in pagetable, or NULL when a page directory
+// on the way is empty. *next is set to the va after that PTE, or after the whole range the
+// empty directory covers, so that a walk over a sparse area skips its holes in one step.
+//
+static pte_t *next_leaf(pagetable_t pagetable, uint64 va, uint64 *next) {
+  pagetable_t pt = pagetable;
+  for (int level = 2; level > 0; level--) {
+    pte_t pte = pt[PX(level, va)];
+    if ((pte & PTE_V) == 0) {
+      *next = ROUNDDOWN(va, PXSIZE(level)) + PXSIZE(level);
+      return NULL;
+    }
+    pt = (pagetable_t)PTE2PA(pte);
+  }
+  *next = va + PGSIZE;
+  return &pt[PX(0, va)];
+}
+
+//
+// give process child a copy of the areas of parent. the pages parent has populated are
+// shared copy-on-write: both map them read-only, so the copy costs the page tables only.
+// returns 0, or -1 if memory runs out (the areas copied so far are left to the caller to
+// remove). parent must be the current process of the hart, its TLB is flushed.
+//
+int vma_dup(process *child, process *parent) {
+  for (vm_area *v = parent->vmas; v; v = v->next) {
+    vm_area *c = vma_add(child, v->start, v->end, v->prot, v->file, v->file_off, v->data_start,
+                         v->data_end);
+    if (c == NULL) return -1;
+    if (v == parent->heap) child->heap = c;
+
+    uint64 next;
+    for (uint64 va = v->start; va < v->end; va = next) {
+      pte_t *pte = next_leaf(parent->pagetable, va, &next);
+      if (pte == NULL || (*pte & PTE_V) == 0) continue;
+
+      // the TLB is flushed once at the end, map_pages() (kernel/vmm.c) leaves it alone.
+      void *pa = (void *)PTE2PA(*pte);
+      if (map_pages(child->pagetable, va, PGSIZE, (uint64)pa,
+                    prot_to_type(v->prot & ~PROT_WRITE, 1)) != 0)
+        return -1;
+      // the zero page is shared for good, it is never counted. page_share() is defined
+      // in kernel/pmm.c
+      if (pa != g_zero_page) page_share(pa);
+      *pte &= ~PTE_W;
+    }
+  }
+  flush_tlb();
+  return 0;
+}
+
+//
+// find a free range of length bytes for a new area of p, as high as possible below top
+// and not below bottom. returns 0 if there is no such range.
+//
+uint64 vma_find_gap(process *p, uint64 length, uint64 bottom, uint64 top) {
+  length = ROUNDUP(length, PGSIZE);
+  if (length == 0 || length > top) return 0;
+
+  uint64 start = ROUNDDOWN(top - length, PGSIZE);
+  while (start >= bottom) {
+    vm_area *v;
+    for (v = p->vmas; v; v = v->next)
+      if (start < v->end && v->start < start + length) break;
+    if (v == NULL) return start;
+    // move below the area in the way.
+    if (v->start < length) return 0;
+    start = v->start - length;
+  }
+  return 0;
+}
+
+//
+// find the VMA of process p that va belongs to.
+//
+vm_area *vma_find(process *p, uint64 va) {
+  for (vm_area *v = p->vmas; v; v = v->next)
+    if (va >= v->start && va < v->end) return v;
+  return NULL;
+}
+
+//
+// populate the page at (page aligned) va of vma for an access of the given cause.
+// a page that holds no file data (bss, heap or stack) is mapped to the shared zero page
+// when it is only read, and gets its own page when it is written. for a page holding file
+// data, only the bytes of the file are read, and the rest of the page is zero-filled.
+//
+static int vma_populate(process *p, vm_area *vma, uint64 va, uint64 cause) {
+  uint64 lo = va, hi = va;
+  if (vma->file) {
+    lo = MAX(va, vma->data_start);
+    hi = MIN(va + PGSIZE, vma->data_end);
+  }
+
+  if (lo >= hi && cause != CAUSE_STORE_PAGE_FAULT) {
+    // g_zero_page is defined in kernel/vmm.c. the mapping is read-only, a later store
+    // faults and copies it (see vma_fault()).
+    user_vm_map(p->pagetable, va, PGSIZE, (uint64)g_zero_page,
+                prot_to_type(vma->prot & ~PROT_WRITE, 1));
+    return 0;
+  }
+
+  void *pa = alloc_page();
+  if (pa == NULL) return -1;
+
+  if (lo < hi) {
+    // zero-fill the head and tail of the page, and read the bytes in between.
+    memset(pa, 0, lo - va);
+    memset(pa + (hi - va), 0, va + PGSIZE - hi);
+    uint64 off = vma->file_off + (lo - vma->data_start);
+    if (vma->file->ops->read(vma->file, pa + (lo - va), hi - lo, off) != hi - lo) {
+      free_page(pa);
+      return -1;
+    }
+  } else {
+    memset(pa, 0, PGSIZE);
+  }
+
+  user_vm_map(p->pagetable, va, PGSIZE, (uint64)pa, prot_to_type(vma->prot, 1));
+  return 0;
+}
+
+//
+// resolve a page fault of process p at va. cause is the scause of the fault. returns 0
+// if the page was populated (or copied), -1 if the access is illegal.
+//
+int vma_fault(process *p, uint64 va, uint64 cause) {
+  vm_area *vma = vma_find(p, va);
+  if (vma == NULL) return -1;
+
+  switch (cause) {
+    case CAUSE_STORE_PAGE_FAULT:
+      if (!(vma->prot & PROT_WRITE)) return -1;
+      break;
+    case CAUSE_FETCH_PAGE_FAULT:
+      if (!(vma->prot & PROT_EXEC)) return -1;
+      break;
+    default:
+      if (!(vma->prot & PROT_READ)) return -1;
+      break;
+  }
+
+  va = ROUNDDOWN(va, PGSIZE);
+  pte_t *pte = page_walk(p->pagetable, va, 0);
+  if (pte == NULL || (*pte & PTE_V) == 0) return vma_populate(p, vma, va, cause);
+
+  // the page is present. the only legal case is a store to a page mapped read-only in a
+  // writable area: the shared zero page, or a page shared with a fork.
+  if (cause != CAUSE_STORE_PAGE_FAULT || (*pte & PTE_W)) return -1;
+  void *old = (void *)PTE2PA(*pte);
+
+  // nobody else maps the page any more: it only needs to be writable again.
+  if (old != g_zero_page && !page_shared(old)) {
+    *pte |= PTE_W | PTE_D;
+    flush_tlb();
+    return 0;
+  }
+
+  void *pa = alloc_page();
+  if (pa == NULL) return -1;
+  if (old == g_zero_page)
+    memset(pa, 0, PGSIZE);
+  else
+    memcpy(pa, old, PGSIZE);
+  // drop the mapping of the old page (the last one frees it, see page_put()).
+  user_vm_unmap(p->pagetable, va, PGSIZE, 1);
+  user_vm_map(p->pagetable, va, PGSIZE, (uint64)pa, prot_to_type(vma->prot, 1));
+  return 0;
+}
+
+//
+// does the user buffer [va, va+n) lie within user space? (whether it is mapped is checked
+// when it is accessed.)
+//
+int user_range_ok(uint64 va, size_t n) { return va + n >= va && va + n <= USER_SPACE_TOP; }
+
+//
+// copy n bytes between the kernel buffer kbuf and the user buffer at va of process p, in
+// the direction given by to_user. returns 0, or -1 if the user buffer is not accessible.
+//
+static int copy_user(process *p, void *kbuf, uint64 va, size_t n, int to_user) {
+  if (!user_range_ok(va, n)) return -1;
+  while (n > 0) {
+    char *pa = (char *)vma_va_to_pa(p, va, to_user);
+    if (pa == NULL) return -1;
+    size_t len = MIN(n, PGSIZE - (va & (PGSIZE - 1)));
+    if (to_user)
+      memcpy(pa, kbuf, len);
+    else
+      memcpy(kbuf, pa, len);
+    kbuf += len;
+    va += len;
+    n -= len;
+  }
+  return 0;
+}
+
+int copy_from_user(process *p, void *dst, uint64 va, size_t n) { return copy_user(p, dst, va, n, 0); }
+
+int copy_to_user(process *p, uint64 va, const void *src, size_t n) {
+  return copy_user(p, (void *)src, va, n, 1);
+}
+
+//
+// copy the string at va of process p (with the terminating 0) to dst, which holds max
+// bytes. returns the length of the string, or -1 if it is not accessible or too long.
+//
+int64 strncpy_from_user(process *p, char *dst, uint64 va, size_t max) {
+  for (size_t i = 0; i < max; i++, va++) {
+    char *pa = (char *)vma_va_to_pa(p, va, 0);
+    if (pa == NULL) return -1;
+    if ((dst[i] = *pa) == 0) return i;
+  }
+  return -1;
+}
+
+//
+// translate the user virtual address va of process p into its physical address, for the
+// kernel to access. the page is populated first if it has not been touched yet.
+//
+void *vma_va_to_pa(process *p, uint64 va, int write) {
+  if (va >= USER_SPACE_TOP) return NULL;
+
+  pte_t *pte = page_walk(p->pagetable, va, 0);
+  if (pte == NULL || (*pte & PTE_V) == 0) {
+    if (vma_fault(p, va, write ? CAUSE_STORE_PAGE_FAULT : CAUSE_LOAD_PAGE_FAULT) != 0)
+      return NULL;
+    pte = page_walk(p->pagetable, va, 0);
+  } else if (write && (*pte & PTE_W) == 0) {
+    // a page mapped to the shared zero page, or shared with a fork. copy it on write.
+    if (vma_fault(p, va, CAUSE_STORE_PAGE_FAULT) != 0) return NULL;
+    pte = page_walk(p->pagetable, va, 0);
+  }
+
+  return (void *)(PTE2PA(*pte) + (va & (PGSIZE - 1)));
+}
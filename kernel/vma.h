@@ -0,0 +1,41 @@
+#ifndef _VMA_H_
+#define _VMA_H_
+
+#include "util/types.h"
+
+struct process_t;
+struct kfile_t;
+
+// a virtual memory area of a process. its pages are populated on their first access
+// (in the page fault handler), rather than when the area is created.
+typedef struct vm_area_t {
+  // [start, end) is the (page aligned) range of user virtual addresses of the area.
+  uint64 start, end;
+  // permissions of the area: PROT_READ, PROT_WRITE and PROT_EXEC defined in kernel/vmm.h
+  int prot;
+  // for file-backed areas, the bytes at [data_start, data_end) are read from the open
+  // file "file" (see kernel/file.h), starting from offset "file_off". the rest of the area
+  // reads as zeros. file is NULL for anonymous areas.
+  struct kfile_t *file;
+  uint64 file_off;
+  uint64 data_start, data_end;
+  // next area of the same process
+  struct vm_area_t *next;
+} vm_area;
+
+void vma_init(void);
+vm_area *vma_add(struct process_t *p, uint64 start, uint64 end, int prot, struct kfile_t *file,
+                 uint64 file_off, uint64 data_start, uint64 data_end);
+int vma_resize(struct process_t *p, vm_area *vma, uint64 new_end);
+void vma_remove(struct process_t *p, vm_area *vma);
+int vma_dup(struct process_t *child, struct process_t *parent);
+uint64 vma_find_gap(struct process_t *p, uint64 length, uint64 bottom, uint64 top);
+int user_range_ok(uint64 va, size_t n);
+int copy_from_user(struct process_t *p, void *dst, uint64 va, size_t n);
+int copy_to_user(struct process_t *p, uint64 va, const void *src, size_t n);
+int64 strncpy_from_user(struct process_t *p, char *dst, uint64 va, size_t max);
+vm_area *vma_find(struct process_t *p, uint64 va);
+int vma_fault(struct process_t *p, uint64 va, uint64 cause);
+void *vma_va_to_pa(struct process_t *p, uint64 va, int write);
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * virtual address mapping related functions.
+ *
+ * the kernel direct-maps the whole DRAM with the largest (1GB or 2MB) leaf PTEs that fit,
+ * so page walks and TLB misses stay cheap on the kernel side. user segments are mapped
+ * with 4KB pages. every user page table shares the kernel mappings, so that traps can be
+ * handled without switching page tables.
+ */
+
+#include "vmm.h"
+#include "riscv.h"
+#include "pmm.h"
+#include "memlayout.h"
+#include "util/types.h"
+#include "util/functions.h"
+#include "string.h"
+#include "spike_interface/spike_utils.h"
+
+// g_mem_size is defined in spike_interface/spike_memory.c, size of the emulated memory
+extern uint64 g_mem_size;
+
+//
+// walk the page table to the PTE of the given level (0 for a 4KB leaf, 1 for a 2MB
+// megapage, 2 for a 1GB gigapage) that covers va. missing page-table pages are allocated
+// on the way if alloc is nonzero. returns NULL if va is covered by a larger leaf, or if the
+// walk fails.
+//
+static pte_t *walk_to_level(pagetable_t page_dir, uint64 va, int level, int alloc) {
+  if (va >= MAXVA) panic("page_walk: va 0x%lx is out of range.\n", va);
+
+  // starting from the page directory
+  pagetable_t pt = page_dir;
+
+  // traverse from the root down to the requested level.
+  for (int l = 2; l > level; l--) {
+    pte_t *pte = pt + PX(l, va);
+
+    if (*pte & PTE_V) {
+      // a megapage leaf already covers va.
+      if (PTE_LEAF(*pte)) return NULL;
+      pt = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if (!alloc || (pt = (pagetable_t)alloc_page()) == NULL) return NULL;
+      memset(pt, 0, PGSIZE);
+      *pte = PA2PTE(pt) | PTE_V;
+    }
+  }
+
+  return pt + PX(level, va);
+}
+
+//
+// map virtual address [va, va+size] to [pa, pa+size] (for internal use) with 4KB pages.
+//
+int map_pages(pagetable_t page_dir, uint64 va, uint64 size, uint64 pa, int perm) {
+  uint64 first, last;
+  pte_t *pte;
+
+  for (first = ROUNDDOWN(va, PGSIZE), last = ROUNDDOWN(va + size - 1, PGSIZE);
+      first <= last; first += PGSIZE, pa += PGSIZE) {
+    if ((pte = page_walk(page_dir, first, 1)) == 0) return -1;
+    if (*pte & PTE_V)
+      panic("map_pages fails on mapping va (0x%lx) to pa (0x%lx)", first, pa);
+    *pte = PA2PTE(pa) | perm | PTE_V;
+  }
+  return 0;
+}
+
+//
+// convert permission code to permission types of PTE
+//
+uint64 prot_to_type(int prot, int user) {
+  uint64 perm = 0;
+  if (prot & PROT_READ) perm |= PTE_R | PTE_A;
+  if (prot & PROT_WRITE) perm |= PTE_W | PTE_D;
+  if (prot & PROT_EXEC) perm |= PTE_X | PTE_A;
+  if (perm == 0) perm = PTE_R;
+  if (user) perm |= PTE_U;
+  return perm;
+}
+
+//
+// traverse the page table (starting from page_dir) to find the 4KB leaf PTE of va.
+//
+pte_t *page_walk(pagetable_t page_dir, uint64 va, int alloc) {
+  return walk_to_level(page_dir, va, 0, alloc);
+}
+
+//
+// look up the physical address of the (4KB) page that va lies in, following leaves of any
+// level. returns 0 if va is not mapped.
+//
+uint64 lookup_pa(pagetable_t pagetable, uint64 va) {
+  if (va >= MAXVA) return 0;
+
+  pagetable_t pt = pagetable;
+  for (int level = 2; level >= 0; level--) {
+    pte_t pte = pt[PX(level, va)];
+    if ((pte & PTE_V) == 0) return 0;
+    if (PTE_LEAF(pte))
+      return PTE2PA(pte) + ROUNDDOWN(va & (PXSIZE(level) - 1), PGSIZE);
+    pt = (pagetable_t)PTE2PA(pte);
+  }
+  return 0;
+}
+
+// pointer to kernel page directory
+pagetable_t g_kernel_pagetable;
+
+// the shared, read-only page of zeros. untouched bss, heap and stack pages map it.
+void *g_zero_page;
+
+//
+// maps virtual address [va, va+sz] to [pa, pa+sz] (for kernel), using the largest leaf
+// (1GB, 2MB or 4KB) that both addresses are aligned to at every step.
+//
+void kern_vm_map(pagetable_t page_dir, uint64 va, uint64 pa, uint64 sz, int perm) {
+  uint64 end = va + sz;
+
+  while (va < end) {
+    int level = 2;
+    while (level > 0 && (((va | pa) & (PXSIZE(level) - 1)) || va + PXSIZE(level) > end))
+      level--;
+
+    pte_t *pte = walk_to_level(page_dir, va, level, 1);
+    if (pte == NULL || (*pte & PTE_V))
+      panic("kern_vm_map fails on mapping va (0x%lx) to pa (0x%lx)", va, pa);
+    *pte = PA2PTE(pa) | perm | PTE_V;
+
+    va += PXSIZE(level);
+    pa += PXSIZE(level);
+  }
+}
+
+//
+// kern_vm_init() constructs the kernel page table: a direct map of the whole DRAM,
+// which covers the kernel image as well as every page managed by kernel/pmm.c.
+//
+void kern_vm_init(void) {
+  // pagetable_t is defined in kernel/riscv.h. it's actually uint64*
+  pagetable_t t_page_dir;
+
+  // allocate a page (t_page_dir) to be the page directory for kernel. alloc_page is
+  // defined in kernel/pmm.c
+  t_page_dir = (pagetable_t)alloc_page();
+  memset(t_page_dir, 0, PGSIZE);
+
+  // the kernel mappings are shared by all page tables, hence global.
+  kern_vm_map(t_page_dir, KERN_BASE, DRAM_BASE, g_mem_size,
+         prot_to_type(PROT_READ | PROT_WRITE | PROT_EXEC, 0) | PTE_G);
+
+  g_kernel_pagetable = t_page_dir;
+
+  g_zero_page = alloc_page();
+  memset(g_zero_page, 0, PGSIZE);
+}
+
+//
+// create the page directory of a user process. the entries covering the kernel (all
+// above USER_SPACE_TOP) are copied from the kernel page table, so that the trap vector,
+// trapframes and kernel stacks stay reachable while the user page table is in use.
+//
+pagetable_t user_pagetable_create(void) {
+  pagetable_t page_dir = (pagetable_t)alloc_page();
+  if (page_dir == NULL) return NULL;
+
+  memset(page_dir, 0, PGSIZE);
+  for (int i = PX(2, USER_SPACE_TOP); i < PGSIZE / sizeof(pte_t); i++)
+    page_dir[i] = g_kernel_pagetable[i];
+
+  return page_dir;
+}
+
+//
+// free the page directory of a user process, with the page-table pages below it that map
+// user space. the user pages must have been unmapped already; the kernel entries are
+// shared with the kernel page table, and are left alone.
+//
+void user_pagetable_free(pagetable_t page_dir) {
+  for (int i = 0; i < PX(2, USER_SPACE_TOP); i++) {
+    if ((page_dir[i] & PTE_V) == 0 || PTE_LEAF(page_dir[i])) continue;
+    pagetable_t pmd = (pagetable_t)PTE2PA(page_dir[i]);
+    for (int j = 0; j < PGSIZE / sizeof(pte_t); j++)
+      if ((pmd[j] & PTE_V) && !PTE_LEAF(pmd[j])) free_page((void *)PTE2PA(pmd[j]));
+    free_page(pmd);
+  }
+  free_page(page_dir);
+}
+
+//
+// convert and return the corresponding physical address of a virtual address (va) of
+// application.
+//
+void *user_va_to_pa(pagetable_t page_dir, void *va) {
+  if ((uint64)va >= USER_SPACE_TOP) return NULL;
+  uint64 pa = lookup_pa(page_dir, (uint64)va);
+  if (pa == 0) return NULL;
+  return (void *)(pa + ((uint64)va & (PGSIZE - 1)));
+}
+
+//
+// maps virtual address [va, va+size] to [pa, pa+size] (for user application).
+//
+void user_vm_map(pagetable_t page_dir, uint64 va, uint64 size, uint64 pa, int perm) {
+  if (map_pages(page_dir, va, size, pa, perm) != 0) {
+    panic("fail to user_vm_map .\n");
+  }
+  flush_tlb();
+}
+
+//
+// unmap virtual address [va, va+size] from the user app.
+// reclaim the physical pages if free!=0 (a page shared with other processes is freed by
+// the last of them, see page_put() in kernel/pmm.c)
+//
+void user_vm_unmap(pagetable_t page_dir, uint64 va, uint64 size, int free) {
+  uint64 first, last;
+
+  for (first = ROUNDDOWN(va, PGSIZE), last = ROUNDDOWN(va + size - 1, PGSIZE);
+      first <= last; first += PGSIZE) {
+    pte_t *pte = page_walk(page_dir, first, 0);
+    if (pte == NULL || (*pte & PTE_V) == 0) continue;
+    if (free && PTE2PA(*pte) != (uint64)g_zero_page) page_put((void *)PTE2PA(*pte));
+    *pte = 0;
+  }
+  flush_tlb();
+}
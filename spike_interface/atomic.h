@@ -5,11 +5,84 @@
 #ifndef _RISCV_ATOMIC_H_
 #define _RISCV_ATOMIC_H_
 
-// Currently, interrupts are always disabled in M-mode.
-// todo: for PKE, wo turn on irq in lab_1_3_timer, so wo have to implement these two functions.
-#define disable_irqsave() (0)
-#define enable_irqrestore(flags) ((void)(flags))
+// the read-modify-write operations below are the AMOs and LR/SC of the RISC-V A extension,
+// so they are atomic across harts. the plain ones (atomic_add, atomic_swap, atomic_cas, ...)
+// are fully ordered (.aqrl), and return the old value. the locks order with acquire on
+// lock and release on unlock only.
 
+// interrupts are masked with sstatus.SIE. M mode never takes interrupts while it runs,
+// so the same code serves both modes.
+#define SSTATUS_SIE_BIT 2L
+
+static inline long disable_irqsave(void) {
+  long flags;
+  asm volatile("csrrc %0, sstatus, %1" : "=r"(flags) : "r"(SSTATUS_SIE_BIT) : "memory");
+  return flags & SSTATUS_SIE_BIT;
+}
+
+static inline void enable_irqrestore(long flags) {
+  if (flags) asm volatile("csrs sstatus, %0" ::"r"(SSTATUS_SIE_BIT) : "memory");
+}
+
+#define mb() asm volatile("fence" ::: "memory")
+// the accesses before an acquire barrier (a lock taken) happen before the accesses after
+// it, and those before a release barrier (a lock given back) before the store after it.
+#define acquire_barrier() asm volatile("fence r, rw" ::: "memory")
+#define release_barrier() asm volatile("fence rw, w" ::: "memory")
+#define atomic_set(ptr, val) (*(volatile typeof(*(ptr))*)(ptr) = val)
+#define atomic_read(ptr) (*(volatile typeof(*(ptr))*)(ptr))
+
+#define AMO_OP(name, insn, type, sfx)                                                  \
+  static inline type __amo_##name##_##sfx(volatile type* p, type v) {                  \
+    type old;                                                                          \
+    asm volatile(insn "." #sfx ".aqrl %0, %2, %1" : "=r"(old), "+A"(*p) : "r"(v) : "memory"); \
+    return old;                                                                        \
+  }
+AMO_OP(add, "amoadd", int, w)
+AMO_OP(add, "amoadd", long, d)
+AMO_OP(or, "amoor", int, w)
+AMO_OP(or, "amoor", long, d)
+AMO_OP(swap, "amoswap", int, w)
+AMO_OP(swap, "amoswap", long, d)
+#undef AMO_OP
+
+// compare-and-swap with LR/SC: store swp if *p holds cmp. returns the old value.
+#define LRSC_CAS(type, sfx)                                                   \
+  static inline type __lrsc_cas_##sfx(volatile type* p, type cmp, type swp) { \
+    type old;                                                                 \
+    int fail;                                                                 \
+    asm volatile(                                                             \
+        "1: lr." #sfx ".aqrl %0, %2\n"                                        \
+        "   bne %0, %3, 2f\n"                                                 \
+        "   sc." #sfx ".rl %1, %4, %2\n"                                      \
+        "   bnez %1, 1b\n"                                                    \
+        "2:"                                                                  \
+        : "=&r"(old), "=&r"(fail), "+A"(*p)                                   \
+        : "r"(cmp), "r"(swp)                                                  \
+        : "memory");                                                          \
+    return old;                                                               \
+  }
+LRSC_CAS(int, w)
+LRSC_CAS(long, d)
+#undef LRSC_CAS
+
+// the operations work on 32-bit and 64-bit objects (integers and pointers).
+#define atomic_binop(ptr, inc, op)                                                   \
+  ((typeof(*(ptr) + 0))(sizeof(*(ptr)) == 4                                          \
+                            ? (long)__amo_##op##_w((volatile int*)(ptr), (int)(long)(inc)) \
+                            : __amo_##op##_d((volatile long*)(ptr), (long)(inc))))
+#define atomic_add(ptr, inc) atomic_binop(ptr, inc, add)
+#define atomic_or(ptr, inc) atomic_binop(ptr, inc, or)
+#define atomic_swap(ptr, swp) atomic_binop(ptr, swp, swap)
+#define atomic_cas(ptr, cmp, swp)                                                           \
+  ((typeof(*(ptr) + 0))(sizeof(*(ptr)) == 4                                                 \
+                            ? (long)__lrsc_cas_w((volatile int*)(ptr), (int)(long)(cmp),    \
+                                                 (int)(long)(swp))                          \
+                            : __lrsc_cas_d((volatile long*)(ptr), (long)(cmp), (long)(swp))))
+
+//
+// test-and-test-and-set spinlock, for locks that are rarely contended.
+//
 typedef struct {
   int lock;
   // For debugging:
@@ -20,33 +93,9 @@ typedef struct {
 #define SPINLOCK_INIT \
   { 0 }
 
-#define mb() asm volatile("fence" ::: "memory")
-#define atomic_set(ptr, val) (*(volatile typeof(*(ptr))*)(ptr) = val)
-#define atomic_read(ptr) (*(volatile typeof(*(ptr))*)(ptr))
-
-#define atomic_binop(ptr, inc, op)         \
-  ({                                       \
-    long flags = disable_irqsave();        \
-    typeof(*(ptr)) res = atomic_read(ptr); \
-    atomic_set(ptr, op);                   \
-    enable_irqrestore(flags);              \
-    res;                                   \
-  })
-#define atomic_add(ptr, inc) atomic_binop(ptr, inc, res + (inc))
-#define atomic_or(ptr, inc) atomic_binop(ptr, inc, res | (inc))
-#define atomic_swap(ptr, inc) atomic_binop(ptr, inc, (inc))
-#define atomic_cas(ptr, cmp, swp)                           \
-  ({                                                        \
-    long flags = disable_irqsave();                         \
-    typeof(*(ptr)) res = *(volatile typeof(*(ptr))*)(ptr);  \
-    if (res == (cmp)) *(volatile typeof(ptr))(ptr) = (swp); \
-    enable_irqrestore(flags);                               \
-    res;                                                    \
-  })
-
 static inline int spinlock_trylock(spinlock_t* lock) {
-  int res = atomic_swap(&lock->lock, -1);
-  mb();
+  int res;
+  asm volatile("amoswap.w.aq %0, %2, %1" : "=r"(res), "+A"(lock->lock) : "r"(-1) : "memory");
   return res;
 }
 
@@ -58,8 +107,7 @@ static inline void spinlock_lock(spinlock_t* lock) {
 }
 
 static inline void spinlock_unlock(spinlock_t* lock) {
-  mb();
-  atomic_set(&lock->lock, 0);
+  asm volatile("amoswap.w.rl zero, zero, %0" : "+A"(lock->lock)::"memory");
 }
 
 static inline long spinlock_lock_irqsave(spinlock_t* lock) {
@@ -73,4 +121,72 @@ static inline void spinlock_unlock_irqrestore(spinlock_t* lock, long flags) {
   enable_irqrestore(flags);
 }
 
+//
+// ticket lock: the harts get the lock in the order they asked for it, so none of them
+// starves under contention. all waiters spin on the same word, though.
+//
+typedef struct {
+  volatile int next;   // the ticket of the next hart to ask
+  volatile int owner;  // the ticket being served
+} ticket_lock_t;
+
+#define TICKET_LOCK_INIT \
+  { 0, 0 }
+
+static inline void ticket_lock(ticket_lock_t* lock) {
+  int ticket = __amo_add_w(&lock->next, 1);
+  while (lock->owner != ticket)
+    ;
+  acquire_barrier();
+}
+
+static inline void ticket_unlock(ticket_lock_t* lock) {
+  // only the holder writes owner.
+  release_barrier();
+  lock->owner = lock->owner + 1;
+}
+
+//
+// MCS queue lock: every waiter spins on a node of its own, and the holder hands the lock
+// to the next node in the queue. the spinning stays in the cache of each hart, which
+// keeps heavy contention cheap. the node must stay valid until the lock is given back.
+//
+typedef struct mcs_node_t {
+  struct mcs_node_t* volatile next;
+  volatile int locked;
+} mcs_node;
+
+typedef struct {
+  mcs_node* volatile tail;
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT \
+  { 0 }
+
+static inline void mcs_lock(mcs_lock_t* lock, mcs_node* node) {
+  node->next = 0;
+  node->locked = 1;
+  mcs_node* prev = atomic_swap(&lock->tail, node);
+  if (prev == 0) {
+    acquire_barrier();
+    return;
+  }
+  prev->next = node;
+  while (node->locked)
+    ;
+  acquire_barrier();
+}
+
+static inline void mcs_unlock(mcs_lock_t* lock, mcs_node* node) {
+  if (node->next == 0) {
+    // nobody queued behind us: leave the lock free.
+    if (atomic_cas(&lock->tail, node, 0) == node) return;
+    // a hart has swapped itself in, and links itself to us next.
+    while (node->next == 0)
+      ;
+  }
+  release_barrier();
+  node->next->locked = 0;
+}
+
 #endif
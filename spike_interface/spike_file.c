@@ -12,13 +12,20 @@
 #include "string.h"
 #include "util/functions.h"
 #include "spike_interface/spike_utils.h"
-//#include "../kernel/config.h"
+#include "kernel/config.h"
+#include "kernel/riscv.h"
 
 #define MAX_FILES 128
 #define MAX_FDS 128
 static spike_file_t* spike_fds[MAX_FDS];
 spike_file_t spike_files[MAX_FILES] = {[0 ... MAX_FILES - 1] = {-1, 0}};
 
+// the pread requests each hart has sent to the host, and the bytes they returned. only the
+// hart itself updates its counters, see spike_file_host_reads().
+static struct {
+  uint64 reads, bytes;
+} host_reads[NCPU];
+
 void copy_stat(struct stat* dest_va, struct frontend_stat* src) {
   struct stat* dest = (struct stat*)dest_va;
   dest->st_dev = src->dev;
@@ -106,6 +113,8 @@ spike_file_t* spike_file_openat(int dirfd, const char* fn, int flags, int mode)
   long ret = frontend_syscall(HTIFSYS_openat, dirfd, (uint64)fn, fn_size, flags, mode, 0, 0);
   if (ret >= 0) {
     f->kfd = ret;
+    f->ident_valid = 0;
+    f->ra_next = f->ra_pages = 0;
     return f;
   } else {
     spike_file_decref(f);
@@ -118,7 +127,24 @@ spike_file_t* spike_file_open(const char* fn, int flags, int mode) {
 }
 
 ssize_t spike_file_pread(spike_file_t* f, void* buf, size_t size, off_t offset) {
-  return frontend_syscall(HTIFSYS_pread, f->kfd, (uint64)buf, size, offset, 0, 0, 0);
+  ssize_t r = frontend_syscall(HTIFSYS_pread, f->kfd, (uint64)buf, size, offset, 0, 0, 0);
+  host_reads[cpuid() % NCPU].reads++;
+  if (r > 0) host_reads[cpuid() % NCPU].bytes += r;
+  return r;
+}
+
+//
+// the pread requests the calling hart has sent to the host so far, and their bytes. the
+// difference of two calls around a piece of kernel code is the host traffic of that code,
+// whatever the other harts do meanwhile.
+//
+void spike_file_host_reads(uint64* reads, uint64* bytes) {
+  *reads = host_reads[cpuid() % NCPU].reads;
+  *bytes = host_reads[cpuid() % NCPU].bytes;
+}
+
+ssize_t spike_file_pwrite(spike_file_t* f, const void* buf, size_t size, off_t offset) {
+  return frontend_syscall(HTIFSYS_pwrite, f->kfd, (uint64)buf, size, offset, 0, 0, 0);
 }
 
 ssize_t spike_file_read(spike_file_t* f, void* buf, size_t size) {
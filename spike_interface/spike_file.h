@@ -9,6 +9,14 @@
 typedef struct file {
   int kfd;  // file descriptor of the host file
   uint32 refcnt;
+
+  // identity of the host file for the page cache (kernel/pcache.c), obtained with
+  // HTIFSYS_fstat on the first cached read. valid only if ident_valid is nonzero.
+  int ident_valid;
+  uint64 dev, ino, mtime, size;
+  // read-ahead state of the page cache: next expected page, and the window in pages.
+  uint64 ra_next;
+  uint32 ra_pages;
 } spike_file_t;
 
 extern spike_file_t spike_files[];
@@ -54,8 +62,11 @@ spike_file_t* spike_file_openat(int dirfd, const char* fn, int flags, int mode);
 ssize_t spike_file_lseek(spike_file_t* f, size_t ptr, int dir);
 ssize_t spike_file_read(spike_file_t* f, void* buf, size_t size);
 ssize_t spike_file_pread(spike_file_t* f, void* buf, size_t n, off_t off);
+void spike_file_host_reads(uint64* reads, uint64* bytes);
 ssize_t spike_file_write(spike_file_t* f, const void* buf, size_t n);
+ssize_t spike_file_pwrite(spike_file_t* f, const void* buf, size_t n, off_t off);
 void spike_file_decref(spike_file_t* f);
+void spike_file_incref(spike_file_t* f);
 void spike_file_init(void);
 int spike_file_dup(spike_file_t* f);
 int spike_file_truncate(spike_file_t* f, off_t len);
@@ -69,19 +69,64 @@ extern uint64_t __htif_base;
 #define TOHOST_OFFSET ((uint64)tohost - (uint64)__htif_base)
 #define FROMHOST_OFFSET ((uint64)fromhost - (uint64)__htif_base)
 
-volatile int htif_console_buf;
-static spinlock_t htif_lock = SPINLOCK_INIT;
+// every hart polls the HTIF at each tick, and the console goes through it as well. a
+// ticket lock serves the harts in turn.
+static ticket_lock_t htif_lock = TICKET_LOCK_INIT;
+
+static void htif_complete_inflight(void);
+
+///////////////////////////    console input ring    ////////////////////////////
+// the host answers a console read request (device 1, command 0) with one character, as
+// soon as one is typed. a read request is kept pending at the host at all times (see
+// htif_console_arm()), and every answer is put into the ring by __check_fromhost(), i.e.,
+// whenever HTIF is serviced. readers take characters from the ring without any HTIF
+// round trip. characters that arrive while the ring is full are dropped.
+static uint8 console_ring[HTIF_CONSOLE_RING];
+// free-running counters: the ring holds the characters [console_head, console_tail).
+static volatile uint32 console_head, console_tail;
+static int console_armed, console_enabled;
+static uint64 console_dropped;
+
+static void htif_console_push(uint8 ch) {
+  if (console_tail - console_head == HTIF_CONSOLE_RING) {
+    console_dropped++;
+    return;
+  }
+  console_ring[console_tail % HTIF_CONSOLE_RING] = ch;
+  mb();
+  console_tail++;
+}
+
+//
+// post a console read request if none is pending and the host is idle (called with
+// htif_lock held).
+//
+static void htif_console_arm(void) {
+#if __riscv_xlen == 64
+  if (!console_enabled || console_armed || tohost) return;
+  console_armed = 1;
+  tohost = TOHOST_CMD(1, 0, 0);
+#endif
+}
 
 static void __check_fromhost(void) {
   uint64_t fh = fromhost;
   if (!fh) return;
   fromhost = 0;
 
-  // this should be from the console
+  // the answer to a queued syscall (see below)
+  if (FROMHOST_DEV(fh) == 0) {
+    htif_complete_inflight();
+    return;
+  }
+
+  // else, this should be from the console
   assert(FROMHOST_DEV(fh) == 1);
   switch (FROMHOST_CMD(fh)) {
     case 0:
-      htif_console_buf = 1 + (uint8_t)FROMHOST_DATA(fh);
+      // a typed character, the answer to the pending read request.
+      console_armed = 0;
+      htif_console_push((uint8)FROMHOST_DATA(fh));
       break;
     case 1:
       break;
@@ -95,59 +140,226 @@ static void __set_tohost(uint64 dev, uint64 cmd, uint64 data) {
   tohost = TOHOST_CMD(dev, cmd, data);
 }
 
-static void do_tohost_fromhost(uint64 dev, uint64 cmd, uint64 data) {
-  spinlock_lock(&htif_lock);
-  __set_tohost(dev, cmd, data);
+///////////////////////////    HTIF syscall request queue    ////////////////////////////
+// the host serves one syscall at a time: a request is submitted by writing the address of
+// its magic_mem block to tohost, and completes when the host answers on fromhost. requests
+// are queued in HTIF_NR_SLOTS descriptors, and htif_poll() moves them forward without ever
+// spinning, so callers can do other work while the host is busy.
+// HTIF_CALLBACK marks a completed request whose callback is running.
+enum { HTIF_FREE = 0, HTIF_QUEUED, HTIF_INFLIGHT, HTIF_DONE, HTIF_CALLBACK };
 
-  while (1) {
-    uint64_t fh = fromhost;
-    if (fh) {
-      if (FROMHOST_DEV(fh) == dev && FROMHOST_CMD(fh) == cmd) {
-        fromhost = 0;
-        break;
-      }
-      __check_fromhost();
-    }
+typedef struct htif_request_t {
+  // the syscall number and arguments, and the result in magic_mem[0] after completion.
+  volatile uint64 magic_mem[8];
+  volatile int state;
+  htif_callback cb;
+  void *cb_arg;
+  int next;  // next queued request, -1 for the last one
+} __attribute__((aligned(64))) htif_request;
+
+static htif_request htif_reqs[HTIF_NR_SLOTS];
+// queue of submitted requests (slot indices), and the request the host is serving.
+static int htif_queue_head = -1, htif_queue_tail = -1;
+static int htif_inflight = -1;
+
+//
+// mark the request served by the host as completed (called with htif_lock held).
+//
+static void htif_complete_inflight(void) {
+  assert(htif_inflight >= 0);
+  int slot = htif_inflight;
+  htif_inflight = -1;
+  mb();
+  htif_reqs[slot].state = HTIF_DONE;
+}
+
+//
+// queue a syscall for the host. cb (if not NULL) is called with cb_arg and the result
+// when the request completes, and the slot is then released automatically. without a
+// callback, the result is collected (and the slot released) by htif_wait(). returns the
+// slot of the request, or -1 if all slots are in use.
+//
+int htif_submit(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5,
+                uint64 a6, htif_callback cb, void *cb_arg) {
+  ticket_lock(&htif_lock);
+  int slot;
+  for (slot = 0; slot < HTIF_NR_SLOTS; slot++)
+    if (htif_reqs[slot].state == HTIF_FREE) break;
+  if (slot == HTIF_NR_SLOTS) {
+    ticket_unlock(&htif_lock);
+    return -1;
   }
-  spinlock_unlock(&htif_lock);
+
+  htif_request *req = &htif_reqs[slot];
+  req->magic_mem[0] = n;
+  req->magic_mem[1] = a0;
+  req->magic_mem[2] = a1;
+  req->magic_mem[3] = a2;
+  req->magic_mem[4] = a3;
+  req->magic_mem[5] = a4;
+  req->magic_mem[6] = a5;
+  req->magic_mem[7] = a6;
+  req->cb = cb;
+  req->cb_arg = cb_arg;
+  req->next = -1;
+  req->state = HTIF_QUEUED;
+
+  if (htif_queue_tail >= 0)
+    htif_reqs[htif_queue_tail].next = slot;
+  else
+    htif_queue_head = slot;
+  htif_queue_tail = slot;
+  ticket_unlock(&htif_lock);
+
+  // start it right away if the host is idle.
+  htif_poll();
+  return slot;
+}
+
+//
+// make progress on the queue: collect the answer of the host (if any), and hand the next
+// queued request to the host once it is idle. returns the number of completion callbacks
+// that were run.
+//
+int htif_poll(void) {
+  ticket_lock(&htif_lock);
+  __check_fromhost();
+
+  if (htif_inflight < 0 && htif_queue_head >= 0 && !tohost) {
+    int slot = htif_queue_head;
+    htif_queue_head = htif_reqs[slot].next;
+    if (htif_queue_head < 0) htif_queue_tail = -1;
+    htif_reqs[slot].state = HTIF_INFLIGHT;
+    htif_inflight = slot;
+    mb();
+    tohost = TOHOST_CMD(0, 0, (uint64)htif_reqs[slot].magic_mem);
+  }
+  htif_console_arm();
+  ticket_unlock(&htif_lock);
+
+  // run the callbacks of completed requests without the lock held, they may submit
+  // further requests. a request is claimed by moving it out of HTIF_DONE.
+  int done = 0;
+  for (int slot = 0; slot < HTIF_NR_SLOTS; slot++) {
+    htif_request *req = &htif_reqs[slot];
+    if (req->cb == NULL || atomic_cas(&req->state, HTIF_DONE, HTIF_CALLBACK) != HTIF_DONE)
+      continue;
+    req->cb(req->cb_arg, (long)req->magic_mem[0]);
+    req->cb = NULL;
+    mb();
+    req->state = HTIF_FREE;
+    done++;
+  }
+  return done;
+}
+
+//
+// has the request in slot completed?
+//
+int htif_completed(int slot) {
+  htif_poll();
+  return htif_reqs[slot].state == HTIF_DONE;
+}
+
+//
+// wait for the request in slot (submitted without a callback), release the slot, and
+// return the result of the syscall.
+//
+long htif_wait(int slot) {
+  while (htif_reqs[slot].state != HTIF_DONE) htif_poll();
+  long ret = (long)htif_reqs[slot].magic_mem[0];
+  htif_reqs[slot].state = HTIF_FREE;
+  return ret;
+}
+
+//
+// submit a request, waiting for a free slot if necessary, and wait for its result.
+//
+long htif_sync(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5,
+               uint64 a6) {
+  int slot;
+  while ((slot = htif_submit(n, a0, a1, a2, a3, a4, a5, a6, NULL, NULL)) < 0) htif_poll();
+  return htif_wait(slot);
 }
 
 /////////////////////    Encapsulated Spike HTIF functionalities    //////////////////
-void htif_syscall(uint64 arg) { do_tohost_fromhost(0, 0, arg); }
+//
+// serve the syscall described by the magic_mem block at arg, in place.
+//
+void htif_syscall(uint64 arg) {
+  volatile uint64 *mm = (volatile uint64 *)arg;
+  mm[0] = htif_sync(mm[0], mm[1], mm[2], mm[3], mm[4], mm[5], mm[6], mm[7]);
+}
 
 // htif fuctionalities
 void htif_console_putchar(uint8_t ch) {
 #if __riscv_xlen == 32
   // HTIF devices are not supported on RV32, so proxy a write system call
-  volatile uint64_t magic_mem[8];
-  magic_mem[0] = HTIFSYS_write;
-  magic_mem[1] = 1;
-  magic_mem[2] = (uint64)&ch;
-  magic_mem[3] = 1;
-  do_tohost_fromhost(0, 0, (uint64)magic_mem);
+  htif_sync(HTIFSYS_write, 1, (uint64)&ch, 1, 0, 0, 0, 0);
 #else
-  spinlock_lock(&htif_lock);
+  ticket_lock(&htif_lock);
   __set_tohost(1, 1, ch);
-  spinlock_unlock(&htif_lock);
+  ticket_unlock(&htif_lock);
 #endif
 }
 
-int htif_console_getchar(void) {
-#if __riscv_xlen == 32
-  // HTIF devices are not supported on RV32
-  return -1;
-#endif
+// the host fd of the M-mode console output: stderr, where the kernel log goes as well
+// (see spike_interface/spike_log.c), so that the messages of both keep their order.
+#define HTIF_CONSOLE_FD 2
 
-  spinlock_lock(&htif_lock);
-  __check_fromhost();
-  int ch = htif_console_buf;
-  if (ch >= 0) {
-    htif_console_buf = -1;
-    __set_tohost(1, 0, 0);
+//
+// write len bytes of buf to the host console with a single HTIFSYS_write, proxied through
+// a (statically allocated) request slot. falls back to the per-character console device
+// when the syscall proxy fails. returns 0 on success, -1 if nothing could be written.
+//
+int htif_console_write(const char *buf, size_t len) {
+  if (len == 0) return 0;
+
+  long ret = htif_sync(HTIFSYS_write, HTIF_CONSOLE_FD, (uint64)buf, len, 0, 0, 0, 0);
+
+  if (ret == len) return 0;
+
+  // the proxy is unavailable (or wrote only a part): resend the rest byte by byte.
+  if (!htif) return -1;
+  for (size_t i = ret > 0 ? ret : 0; i < len; i++) htif_console_putchar(buf[i]);
+  return 0;
+}
+
+//
+// start buffering console input: from now on, typed characters are collected in the
+// console ring.
+//
+void htif_console_enable(void) {
+  console_enabled = 1;
+  htif_poll();
+}
+
+//
+// move at most n buffered characters of console input to buf, without waiting.
+// returns the number of characters moved, 0 if none has arrived.
+//
+size_t htif_console_read(char *buf, size_t n) {
+  if (!console_enabled) htif_console_enable();
+  htif_poll();
+
+  ticket_lock(&htif_lock);
+  size_t done = 0;
+  while (done < n && console_head != console_tail) {
+    buf[done++] = console_ring[console_head % HTIF_CONSOLE_RING];
+    console_head++;
   }
-  spinlock_unlock(&htif_lock);
+  ticket_unlock(&htif_lock);
+  return done;
+}
 
-  return ch - 1;
+//
+// number of characters waiting in the console ring.
+//
+size_t htif_console_avail(void) { return console_tail - console_head; }
+
+int htif_console_getchar(void) {
+  char ch;
+  return htif_console_read(&ch, 1) ? (uint8)ch : -1;
 }
 
 void htif_poweroff(void) {
@@ -94,10 +94,29 @@
 extern uint64 htif;
 void query_htif(uint64 dtb);
 
+// asynchronous HTIF syscalls (see spike_interface/spike_htif.c).
+#define HTIF_NR_SLOTS 8
+typedef void (*htif_callback)(void *arg, long ret);
+
+int htif_submit(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5,
+                uint64 a6, htif_callback cb, void *cb_arg);
+int htif_poll(void);
+int htif_completed(int slot);
+long htif_wait(int slot);
+long htif_sync(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5,
+               uint64 a6);
+
 // Spike HTIF functionalities
 void htif_syscall(uint64);
 
+// console input is buffered in a ring of HTIF_CONSOLE_RING characters.
+#define HTIF_CONSOLE_RING 256
+
 void htif_console_putchar(uint8_t);
+int htif_console_write(const char *buf, size_t len);
+void htif_console_enable(void);
+size_t htif_console_read(char *buf, size_t n);
+size_t htif_console_avail(void);
 int htif_console_getchar();
 void htif_poweroff() __attribute__((noreturn));
 
@@ -0,0 +1,125 @@
+/*
+ * the kernel log: a ring buffer per hart, drained to the host in large batches.
+ *
+ * a message is formatted, stamped with the time and its level, and appended to the ring
+ * of the calling hart. only that hart touches the ring, so appending takes no lock. the
+ * ring goes to the host (stderr) with at most two writes when it fills beyond the
+ * watermark, when klog_flush() is called at timer ticks, and, for the rings of all the
+ * harts, on panic and at shutdown (klog_flush_all()).
+ */
+
+#include "spike_log.h"
+#include "spike_file.h"
+#include "kernel/config.h"
+#include "kernel/riscv.h"
+#include "util/functions.h"
+#include "util/snprintf.h"
+#include "util/string.h"
+
+typedef struct klog_ring_t {
+  char buf[KLOG_RING_SIZE];
+  // bytes [tail, head) (positions taken modulo KLOG_RING_SIZE) are waiting to be written.
+  uint64 head, tail;
+  // is the next byte the beginning of a line (which gets a time stamp and a level)?
+  int line_start;
+} klog_ring;
+
+static klog_ring rings[NCPU] = {[0 ... NCPU - 1] = {.line_start = 1}};
+
+int klog_level = KLOG_LEVEL;
+
+static const char level_tag[] = {'E', 'W', 'I', 'D'};
+
+void klog_set_level(int level) { klog_level = level; }
+
+static inline klog_ring* my_ring(void) { return &rings[cpuid() % NCPU]; }
+
+static inline uint64 read_time(void) {
+  uint64 t;
+  asm volatile("rdtime %0" : "=r"(t));
+  return t;
+}
+
+static int format(char* out, size_t n, const char* s, ...) {
+  va_list vl;
+  va_start(vl, s);
+  int res = vsnprintf(out, n, s, vl);
+  va_end(vl);
+  return res;
+}
+
+static void ring_flush(klog_ring* r) {
+  while (r->tail < r->head) {
+    uint64 off = r->tail % KLOG_RING_SIZE;
+    uint64 len = MIN(r->head - r->tail, KLOG_RING_SIZE - off);
+    spike_file_write(stderr, r->buf + off, len);
+    r->tail += len;
+  }
+}
+
+void klog_flush(void) { ring_flush(my_ring()); }
+
+//
+// write the messages buffered by all the harts, those of the calling hart last. for the
+// shutdown and panic paths only: the rings of the other harts are drained without their
+// owners knowing, which is fine as long as they do not log meanwhile.
+//
+void klog_flush_all(void) {
+  klog_ring* mine = my_ring();
+  for (int i = 0; i < NCPU; i++)
+    if (&rings[i] != mine) ring_flush(&rings[i]);
+  ring_flush(mine);
+}
+
+static void ring_put(klog_ring* r, const char* s, uint64 n) {
+  if (r->head + n - r->tail > KLOG_RING_SIZE) ring_flush(r);
+  // a message longer than the ring is written directly.
+  if (n > KLOG_RING_SIZE) {
+    spike_file_write(stderr, s, n);
+    return;
+  }
+
+  uint64 off = r->head % KLOG_RING_SIZE;
+  uint64 len = MIN(n, KLOG_RING_SIZE - off);
+  memcpy(r->buf + off, s, len);
+  memcpy(r->buf, s + len, n - len);
+  r->head += n;
+}
+
+void vklog(int level, const char* s, va_list vl) {
+  if (level > klog_level) return;
+
+  char out[256];
+  int res = vsnprintf(out, sizeof(out), s, vl);
+  if (res <= 0) return;
+  uint64 n = res < sizeof(out) ? res : sizeof(out) - 1;
+
+  klog_ring* r = my_ring();
+  // every line starts with the time of the message and its level.
+  for (uint64 i = 0; i < n;) {
+    if (r->line_start) {
+      char stamp[32];
+      int len = format(stamp, sizeof(stamp), "[%ld %c] ", read_time(),
+                       level_tag[MIN(level, LOG_DEBUG)]);
+      ring_put(r, stamp, len);
+      r->line_start = 0;
+    }
+    uint64 j = i;
+    while (j < n && out[j] != '\n') j++;
+    if (j < n) {
+      j++;
+      r->line_start = 1;
+    }
+    ring_put(r, out + i, j - i);
+    i = j;
+  }
+
+  if (r->head - r->tail >= KLOG_WATERMARK) ring_flush(r);
+}
+
+void klog_printf(int level, const char* s, ...) {
+  va_list vl;
+  va_start(vl, s);
+  vklog(level, s, vl);
+  va_end(vl);
+}
@@ -0,0 +1,47 @@
+#ifndef _SPIKE_LOG_H_
+#define _SPIKE_LOG_H_
+
+#include <stdarg.h>
+
+#include "util/types.h"
+
+// log levels, from the most to the least important.
+#define LOG_ERR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+// messages above KLOG_LEVEL are compiled out. set it with -DKLOG_LEVEL=... to keep them.
+#ifndef KLOG_LEVEL
+#define KLOG_LEVEL LOG_INFO
+#endif
+
+// every hart appends its messages to its own ring of KLOG_RING_SIZE bytes. the ring is
+// written to the host when it fills beyond KLOG_WATERMARK bytes.
+#define KLOG_RING_SIZE 8192
+#define KLOG_WATERMARK (KLOG_RING_SIZE * 3 / 4)
+
+// messages above klog_level are dropped at run time.
+extern int klog_level;
+
+void klog_set_level(int level);
+void vklog(int level, const char* s, va_list vl);
+void klog_printf(int level, const char* s, ...);
+// write the messages buffered by the calling hart to the host.
+void klog_flush(void);
+// write the messages buffered by all the harts to the host, at shutdown.
+void klog_flush_all(void);
+
+// a disabled level costs nothing: the condition is a compile-time constant for it.
+#define klog(level, s, ...)                                                 \
+  do {                                                                     \
+    if ((level) <= KLOG_LEVEL && (level) <= klog_level)                    \
+      klog_printf(level, s, ##__VA_ARGS__);                                \
+  } while (0)
+
+#define klog_err(s, ...) klog(LOG_ERR, s, ##__VA_ARGS__)
+#define klog_warn(s, ...) klog(LOG_WARN, s, ##__VA_ARGS__)
+#define klog_info(s, ...) klog(LOG_INFO, s, ##__VA_ARGS__)
+#define klog_debug(s, ...) klog(LOG_DEBUG, s, ##__VA_ARGS__)
+
+#endif
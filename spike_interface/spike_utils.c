@@ -8,32 +8,17 @@
 #include "spike_htif.h"
 #include "util/functions.h"
 #include "util/snprintf.h"
+#include "util/string.h"
 #include "spike_utils.h"
 #include "spike_file.h"
+#include "spike_log.h"
 
 //=============    encapsulating htif syscalls, invoking Spike functions    =============
+// the synchronous wrapper of the HTIF request queue (see htif_sync() in spike_htif.c).
+// callers that have other work to do use htif_submit() and htif_poll() instead.
 long frontend_syscall(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4,
       uint64 a5, uint64 a6) {
-  static volatile uint64 magic_mem[8];
-
-  static spinlock_t lock = SPINLOCK_INIT;
-  spinlock_lock(&lock);
-
-  magic_mem[0] = n;
-  magic_mem[1] = a0;
-  magic_mem[2] = a1;
-  magic_mem[3] = a2;
-  magic_mem[4] = a3;
-  magic_mem[5] = a4;
-  magic_mem[6] = a5;
-  magic_mem[7] = a6;
-
-  htif_syscall((uintptr_t)magic_mem);
-
-  long ret = magic_mem[0];
-
-  spinlock_unlock(&lock);
-  return ret;
+  return htif_sync(n, a0, a1, a2, a3, a4, a5, a6);
 }
 
 //===============    Spike-assisted printf, output string to terminal    ===============
@@ -45,10 +30,9 @@ static uintptr_t mcall_console_putchar(uint8 ch) {
 }
 
 void vprintk(const char* s, va_list vl) {
-  char out[256];
-  int res = vsnprintf(out, sizeof(out), s, vl);
-  //you need spike_file_init before this call
-  spike_file_write(stderr, out, res < sizeof(out) ? res : sizeof(out));
+  // messages go through the kernel log ring (spike_interface/spike_log.c). you need
+  // spike_file_init before the ring is flushed.
+  vklog(LOG_INFO, s, vl);
 }
 
 void printk(const char* s, ...) {
@@ -60,14 +44,29 @@ void printk(const char* s, ...) {
   va_end(vl);
 }
 
+//
+// M-mode console output. a string costs one host round trip (see htif_console_write()),
+// rather than one per character.
+//
 void putstring(const char* s) {
-  while (*s) mcall_console_putchar(*s++);
+  if (htif_console_write(s, strlen(s)) != 0)
+    while (*s) mcall_console_putchar(*s++);
 }
 
 void vprintm(const char* s, va_list vl) {
   char buf[256];
-  vsnprintf(buf, sizeof buf, s, vl);
-  putstring(buf);
+  int res = vsnprintf(buf, sizeof buf, s, vl);
+  if (res <= 0) return;
+  htif_console_write(buf, res < sizeof(buf) ? res : sizeof(buf) - 1);
+}
+
+void printm(const char* s, ...) {
+  va_list vl;
+  va_start(vl, s);
+
+  vprintm(s, vl);
+
+  va_end(vl);
 }
 
 void sprint(const char* s, ...) {
@@ -83,6 +82,7 @@ void sprint(const char* s, ...) {
 void poweroff(uint16_t code) {
   assert(htif);
   sprint("Power off\r\n");
+  klog_flush_all();
   if (htif) {
     htif_poweroff();
   } else {
@@ -96,6 +96,7 @@ void poweroff(uint16_t code) {
 
 void shutdown(int code) {
   sprint("System is shutting down with exit code %d.\n", code);
+  klog_flush_all();
   frontend_syscall(HTIFSYS_exit, code, 0, 0, 0, 0, 0, 0);
   while (1)
     ;
@@ -105,10 +106,10 @@ void do_panic(const char* s, ...) {
   va_list vl;
   va_start(vl, s);
 
-  sprint(s, vl);
-  shutdown(-1);
-
+  vklog(LOG_ERR, s, vl);
   va_end(vl);
+
+  shutdown(-1);
 }
 
 void kassert_fail(const char* s) {
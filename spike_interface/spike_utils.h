@@ -5,6 +5,7 @@
 #include "spike_file.h"
 #include "spike_memory.h"
 #include "spike_htif.h"
+#include "spike_log.h"
 
 long frontend_syscall(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5,
                       uint64 a6);
@@ -12,6 +13,8 @@ long frontend_syscall(long n, uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64
 void poweroff(uint16 code) __attribute((noreturn));
 void sprint(const char* s, ...);
 void putstring(const char* s);
+void vprintm(const char* s, va_list vl);
+void printm(const char* s, ...);
 void shutdown(int) __attribute__((noreturn));
 
 #define assert(x)                              \
@@ -0,0 +1,241 @@
+/*
+ * elf_pack: a host tool that packs an application ELF for PKE.
+ *
+ * usage: elf_pack <input elf> <output elf>
+ *
+ * the PT_LOAD segments of the output are stored as LZ4 blocks (raw block format), and a
+ * PT_NOTE segment (the first program header) named "PKE" of type NT_PKE_LZ4 tells the
+ * kernel which segments are packed and how large their blocks are (see elf_load() in
+ * kernel/elf.c). segments that do not shrink are stored as they are. section headers are
+ * dropped, the kernel does not need them.
+ *
+ * the note layout and the constants below must match kernel/elf.h.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ELF_MAGIC 0x464C457FU
+#define ELF_PROG_LOAD 1
+#define ELF_PROG_NOTE 4
+#define PKE_NOTE_NAME "PKE"
+#define NT_PKE_LZ4 0x345a4c01
+// the kernel accepts at most this many packed segments (ELF_MAX_RANGES).
+#define MAX_PACKED 16
+
+typedef struct {
+  uint32_t magic;
+  uint8_t elf[12];
+  uint16_t type, machine;
+  uint32_t version;
+  uint64_t entry, phoff, shoff;
+  uint32_t flags;
+  uint16_t ehsize, phentsize, phnum, shentsize, shnum, shstrndx;
+} elf_header;
+
+typedef struct {
+  uint32_t type, flags;
+  uint64_t off, vaddr, paddr, filesz, memsz, align;
+} elf_prog_header;
+
+typedef struct {
+  uint32_t namesz, descsz, type;
+} elf_note_header;
+
+typedef struct {
+  uint64_t phidx, csize;
+} elf_lz4_entry;
+
+/* --- LZ4 block compressor (greedy, hash of 4-byte sequences) --- */
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_HASH_BITS 16
+// the format requires the last 5 bytes to be literals, and the last match to start at
+// least 12 bytes before the end.
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT 12
+
+static uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static uint32_t lz4_hash(uint32_t v) { return (v * 2654435761U) >> (32 - LZ4_HASH_BITS); }
+
+static uint8_t *put_length(uint8_t *op, size_t len) {
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *lit, size_t nlit, size_t offset,
+                             size_t mlen) {
+  uint8_t *token = op++;
+  *token = (uint8_t)((nlit >= 15 ? 15 : nlit) << 4);
+  if (nlit >= 15) op = put_length(op, nlit - 15);
+  memcpy(op, lit, nlit);
+  op += nlit;
+
+  if (mlen) {
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    mlen -= LZ4_MIN_MATCH;
+    *token |= mlen >= 15 ? 15 : mlen;
+    if (mlen >= 15) op = put_length(op, mlen - 15);
+  }
+  return op;
+}
+
+// upper bound of the compressed size of n bytes.
+static size_t lz4_bound(size_t n) { return n + n / 255 + 16; }
+
+static size_t lz4_compress(const uint8_t *src, size_t n, uint8_t *dst) {
+  static uint32_t table[1 << LZ4_HASH_BITS];
+  memset(table, 0xff, sizeof(table));
+
+  const uint8_t *ip = src, *anchor = src;
+  uint8_t *op = dst;
+
+  if (n > LZ4_MF_LIMIT) {
+    const uint8_t *mflimit = src + n - LZ4_MF_LIMIT;
+    const uint8_t *matchlimit = src + n - LZ4_LAST_LITERALS;
+    while (ip < mflimit) {
+      uint32_t h = lz4_hash(read32(ip));
+      uint32_t cand = table[h];
+      table[h] = (uint32_t)(ip - src);
+
+      if (cand == 0xffffffffU || ip - (src + cand) > 0xffff || read32(src + cand) != read32(ip)) {
+        ip++;
+        continue;
+      }
+
+      const uint8_t *match = src + cand;
+      size_t mlen = LZ4_MIN_MATCH;
+      while (ip + mlen < matchlimit && ip[mlen] == match[mlen]) mlen++;
+
+      op = put_sequence(op, anchor, ip - anchor, ip - match, mlen);
+      ip += mlen;
+      anchor = ip;
+    }
+  }
+
+  // the rest goes out as literals.
+  op = put_sequence(op, anchor, src + n - anchor, 0, 0);
+  return op - dst;
+}
+
+/* --- packing --- */
+
+static uint8_t *read_file(const char *path, size_t *size) {
+  FILE *f = fopen(path, "rb");
+  if (!f) return NULL;
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *buf = malloc(len > 0 ? len : 1);
+  if (buf && fread(buf, 1, len, f) != (size_t)len) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(f);
+  *size = len;
+  return buf;
+}
+
+static void die(const char *msg) {
+  fprintf(stderr, "elf_pack: %s\n", msg);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <input elf> <output elf>\n", argv[0]);
+    return 1;
+  }
+
+  size_t in_size;
+  uint8_t *in = read_file(argv[1], &in_size);
+  if (!in) die("cannot read the input file");
+  if (in_size < sizeof(elf_header)) die("not an elf file");
+
+  elf_header eh;
+  memcpy(&eh, in, sizeof(eh));
+  if (eh.magic != ELF_MAGIC || eh.phentsize != sizeof(elf_prog_header)) die("not an elf file");
+  if (eh.phoff + (uint64_t)eh.phnum * sizeof(elf_prog_header) > in_size) die("truncated elf");
+
+  int nph = eh.phnum + 1;
+  elf_prog_header *ph = calloc(nph, sizeof(elf_prog_header));
+  memcpy(ph + 1, in + eh.phoff, eh.phnum * sizeof(elf_prog_header));
+
+  // output: header, program headers (the note first), the note, then the segments.
+  uint64_t note_off = sizeof(elf_header) + nph * sizeof(elf_prog_header);
+  uint64_t desc_size = sizeof(uint64_t) + eh.phnum * sizeof(elf_lz4_entry);
+  uint64_t note_size = sizeof(elf_note_header) + 4 + desc_size;
+
+  size_t cap = note_off + note_size;
+  for (int i = 1; i < nph; i++) cap += lz4_bound(ph[i].filesz) + 8;
+  uint8_t *out = calloc(cap, 1);
+  uint64_t pos = note_off + note_size;
+
+  uint64_t *desc = (uint64_t *)(out + note_off + sizeof(elf_note_header) + 4);
+  elf_lz4_entry *entries = (elf_lz4_entry *)(desc + 1);
+  uint64_t npacked = 0, plain_bytes = 0, packed_bytes = 0;
+
+  for (int i = 1; i < nph; i++) {
+    if (ph[i].filesz == 0) {
+      ph[i].off = 0;
+      continue;
+    }
+    if (ph[i].off + ph[i].filesz > in_size) die("segment beyond the end of the file");
+
+    pos = (pos + 7) & ~7UL;
+    const uint8_t *data = in + ph[i].off;
+    size_t csize = 0;
+    if (ph[i].type == ELF_PROG_LOAD && npacked < MAX_PACKED)
+      csize = lz4_compress(data, ph[i].filesz, out + pos);
+
+    if (csize && csize < ph[i].filesz) {
+      entries[npacked].phidx = i;
+      entries[npacked].csize = csize;
+      npacked++;
+      ph[i].off = pos;
+      pos += csize;
+    } else {
+      memcpy(out + pos, data, ph[i].filesz);
+      ph[i].off = pos;
+      pos += ph[i].filesz;
+    }
+    plain_bytes += ph[i].filesz;
+    packed_bytes += csize && csize < ph[i].filesz ? csize : ph[i].filesz;
+  }
+
+  // the note, sized for the entries actually used.
+  desc_size = sizeof(uint64_t) + npacked * sizeof(elf_lz4_entry);
+  elf_note_header nh = {sizeof(PKE_NOTE_NAME), (uint32_t)desc_size, NT_PKE_LZ4};
+  memcpy(out + note_off, &nh, sizeof(nh));
+  memcpy(out + note_off + sizeof(nh), PKE_NOTE_NAME, sizeof(PKE_NOTE_NAME));
+  desc[0] = npacked;
+  ph[0].type = ELF_PROG_NOTE;
+  ph[0].off = note_off;
+  ph[0].filesz = sizeof(nh) + 4 + desc_size;
+  ph[0].align = 4;
+
+  eh.phoff = sizeof(elf_header);
+  eh.phnum = nph;
+  eh.shoff = eh.shnum = eh.shentsize = eh.shstrndx = 0;
+  memcpy(out, &eh, sizeof(eh));
+  memcpy(out + eh.phoff, ph, nph * sizeof(elf_prog_header));
+
+  FILE *f = fopen(argv[2], "wb");
+  if (!f || fwrite(out, 1, pos, f) != pos || fclose(f) != 0) die("cannot write the output file");
+
+  printf("elf_pack: %s -> %s, %lu segment(s) packed, %lu -> %lu bytes\n", argv[1], argv[2],
+         (unsigned long)npacked, (unsigned long)plain_bytes, (unsigned long)packed_bytes);
+  return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * a batch of worker processes: the parent forks WORKERS children, each sums a slice of
+ * 1..N and exits with its share (mod 256), and the parent collects them with wait(). the
+ * last worker runs another program with exec() instead.
+ *
+ * $ make run_fork
+ */
+
+#include "user_lib.h"
+#include "util/types.h"
+
+#define WORKERS 4
+#define N 100000
+// the program the last worker runs, built by "make" as well.
+#define EXEC_PATH "obj/app_helloworld"
+
+int main(void) {
+  printu("parent %d forks %d workers.\n", getpid(), WORKERS);
+
+  for (int w = 0; w < WORKERS; w++) {
+    int pid = fork();
+    if (pid < 0) {
+      printu("fork failed, errno %d.\n", errno);
+      exit(-1);
+    }
+    if (pid > 0) continue;
+
+    if (w == WORKERS - 1) {
+      exec(EXEC_PATH);
+      printu("worker %d: exec %s failed, errno %d.\n", getpid(), EXEC_PATH, errno);
+      exit(-1);
+    }
+    uint64 sum = 0, lo = (uint64)w * N / WORKERS, hi = (uint64)(w + 1) * N / WORKERS;
+    for (uint64 i = lo + 1; i <= hi; i++) sum += i;
+    printu("worker %d: slice %d sums to %ld.\n", getpid(), w, sum);
+    exit(sum & 0xff);
+  }
+
+  int status, pid;
+  while ((pid = wait(&status)) > 0) printu("parent: worker %d exited with %d.\n", pid, status);
+  printu("parent: all workers are done (errno %d).\n", errno);
+  exit(0);
+}
@@ -0,0 +1,61 @@
+/*
+ * a microbenchmark of the syscall path: the cycles of a null syscall, i.e., the round
+ * trip of an ecall into the kernel and back for a syscall that does (almost) nothing.
+ *
+ * it is timed on both paths of kernel/strap_vector.S: getpid takes the fast one, that
+ * saves only the registers the C code may clobber, and nop takes the one of fork and
+ * exec, that saves them all (SYSCALL_FULL_FRAME). the syscalls run in batches, and the
+ * fastest batch is reported, so that the timer ticks (and the preemption) taken in
+ * between do not count.
+ *
+ * $ make run_bench
+ */
+
+#include "user_lib.h"
+#include "user_syscall.h"
+#include "util/types.h"
+#include "util/functions.h"
+
+#define BATCHES 20
+#define BATCH_CALLS 10000
+
+static inline uint64 rdcycle(void) {
+  uint64 c;
+  asm volatile("rdcycle %0" : "=r"(c));
+  return c;
+}
+
+// the cycles of the fastest batch of calls of fn.
+static uint64 best_batch(long (*fn)(void)) {
+  // warm up the caches and the TLB.
+  for (int i = 0; i < BATCH_CALLS; i++) fn();
+
+  uint64 best = -1UL;
+  for (int b = 0; b < BATCHES; b++) {
+    uint64 start = rdcycle();
+    for (int i = 0; i < BATCH_CALLS; i++) fn();
+    uint64 cycles = rdcycle() - start;
+    if (cycles < best) best = cycles;
+  }
+  return best;
+}
+
+static long null_call(void) {
+  asm volatile("" ::: "memory");
+  return 0;
+}
+
+int main(void) {
+  // the cost of the loop and the call, to be taken off.
+  uint64 loop = best_batch(null_call);
+  uint64 fast = best_batch(syscall_getpid);
+  uint64 full = best_batch(syscall_nop);
+
+  fast = (fast - MIN(loop, fast)) / BATCH_CALLS;
+  full = (full - MIN(loop, full)) / BATCH_CALLS;
+  printu("null syscall, fast path (getpid): %ld cycles per call.\n", fast);
+  printu("null syscall, full save (nop): %ld cycles per call.\n", full);
+  printu("the fast path saves %ld cycles per call, best of %d batches of %d calls.\n",
+         full - MIN(fast, full), BATCHES, BATCH_CALLS);
+  exit(0);
+}
@@ -7,45 +7,138 @@
 
 #include "user_lib.h"
 #include "util/types.h"
-#include "util/snprintf.h"
 #include "kernel/syscall.h"
+#include "user_syscall.h"
 
-int do_user_call(uint64 sysnum, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5, uint64 a6,
-                 uint64 a7) {
-  int ret;
+// the error of the last failed syscall. <errno.h> reaches it through __errno().
+static int errno_value;
 
-  // before invoking the syscall, arguments of do_user_call are already loaded into the argument
-  // registers (a0-a7) of our (emulated) risc-v machine.
-  asm volatile(
-      "ecall\n"
-      "sw a0, %0"  // returns a 32-bit value
-      : "=m"(ret)
-      :
-      : "memory");
+int *__errno(void) { return &errno_value; }
 
+//
+// the result of a syscall stub (user/user_syscall.h). the kernel returns failures as
+// negative errno values, which are kept in errno, and turned into -1 for the caller.
+//
+static inline long syscall_ret(long ret) {
+  if (ret < 0 && ret >= -SYSCALL_ERRNO_MAX) {
+    errno_value = -ret;
+    return -1;
+  }
   return ret;
 }
 
 //
-// printu() supports user/lab1_1_helloworld.c
+// write n bytes of buf to the file fd (1 is the standard output, 2 the standard error).
 //
-int printu(const char* s, ...) {
-  va_list vl;
-  va_start(vl, s);
-
-  char out[256];  // fixed buffer size.
-  int res = vsnprintf(out, sizeof(out), s, vl);
-  va_end(vl);
-  const char* buf = out;
-  size_t n = res < sizeof(out) ? res : sizeof(out);
+long write(int fd, const void* buf, uint64 n) {
+  return syscall_ret(syscall_write(fd, (long)buf, n));
+}
 
-  // make a syscall to implement the required functionality.
-  return do_user_call(SYS_user_print, (uint64)buf, n, 0, 0, 0, 0, 0);
+//
+// write the iovcnt segments of iov to the file fd with a single syscall.
+//
+long writev(int fd, const struct iovec* iov, int iovcnt) {
+  return syscall_ret(syscall_writev(fd, (long)iov, iovcnt));
 }
 
 //
 // applications need to call exit to quit execution.
 //
 int exit(int code) {
-  return do_user_call(SYS_user_exit, code, 0, 0, 0, 0, 0, 0); 
+  // output still sitting in the stdout buffer (user/user_stdio.c) must not be lost.
+  flush();
+  return syscall_ret(syscall_exit(code));
+}
+
+//
+// move the end of the heap by increment bytes, returns the previous end.
+//
+void *sbrk(long increment) {
+  return (void *)syscall_ret(syscall_sbrk(increment));
+}
+
+//
+// map length bytes of zeroed anonymous memory, at addr if possible.
+//
+void *mmap(void *addr, uint64 length, int prot) {
+  return (void *)syscall_ret(
+      syscall_mmap((long)addr, length, prot, MAP_PRIVATE | MAP_ANONYMOUS));
+}
+
+//
+// unmap a mapping created by mmap().
+//
+int munmap(void *addr, uint64 length) {
+  return syscall_ret(syscall_munmap((long)addr, length));
+}
+
+//
+// open the host file at path. flags are O_RDONLY, O_WRONLY or O_RDWR, with O_CREAT,
+// O_TRUNC and O_APPEND. returns a file descriptor, or -1.
+//
+int open(const char *path, int flags, int mode) {
+  return syscall_ret(syscall_open((long)path, flags, mode));
+}
+
+//
+// read at most n bytes of the file fd into buf. returns the number of bytes read. a read
+// of the console (fd 0) waits for input, and returns what has been typed so far.
+//
+long read(int fd, void *buf, uint64 n) {
+  // a prompt still in the stdout buffer must be seen before waiting for the answer.
+  if (fd == 0) flush();
+  return syscall_ret(syscall_read(fd, (long)buf, n));
 }
+
+//
+// read at most n bytes at offset off of the file fd, without moving its position.
+//
+long pread(int fd, void *buf, uint64 n, uint64 off) {
+  return syscall_ret(syscall_pread(fd, (long)buf, n, off));
+}
+
+long lseek(int fd, long offset, int whence) {
+  return syscall_ret(syscall_lseek(fd, offset, whence));
+}
+
+int fstat(int fd, struct file_stat *st) {
+  return syscall_ret(syscall_fstat(fd, (long)st));
+}
+
+int close(int fd) {
+  return syscall_ret(syscall_close(fd));
+}
+
+int dup(int fd) {
+  return syscall_ret(syscall_dup(fd));
+}
+
+//
+// create a child process, a copy of the calling one. returns the pid of the child to the
+// parent, and 0 to the child.
+//
+int fork(void) {
+  // the buffered output would be written by both processes otherwise.
+  flush();
+  return syscall_ret(syscall_fork());
+}
+
+//
+// run the program at path in the calling process. returns (-1) only on failure.
+//
+int exec(const char *path) {
+  flush();
+  return syscall_ret(syscall_exec((long)path));
+}
+
+//
+// wait for the child pid (any child if pid is -1) to exit, and store its exit code at
+// status (unless it is NULL). returns the pid of the child.
+//
+int waitpid(int pid, int *status) {
+  return syscall_ret(syscall_wait(pid, (long)status));
+}
+
+int wait(int *status) { return waitpid(-1, status); }
+
+int getpid(void) { return syscall_ret(syscall_getpid()); }
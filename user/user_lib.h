@@ -2,5 +2,60 @@
  * header file to be used by applications.
  */
 
-int printu(const char *s, ...);
+#include <errno.h>
+
+#include "util/types.h"
+#include "kernel/syscall.h"
+
+// protection bits of mmap(), same as the ones of the kernel (kernel/vmm.h).
+#define PROT_NONE 0
+#define PROT_READ 1
+#define PROT_WRITE 2
+#define PROT_EXEC 4
+
+// the syscall wrappers return -1 on failure, with the error (an E* value of <errno.h>) in
+// errno.
 int exit(int code);
+long write(int fd, const void *buf, uint64 n);
+long writev(int fd, const struct iovec *iov, int iovcnt);
+
+// host files. descriptors 0, 1 and 2 are the console.
+int open(const char *path, int flags, int mode);
+long read(int fd, void *buf, uint64 n);
+long pread(int fd, void *buf, uint64 n, uint64 off);
+long lseek(int fd, long offset, int whence);
+int fstat(int fd, struct file_stat *st);
+int close(int fd);
+int dup(int fd);
+
+// processes. exec() takes the path of the elf of a program (in the initramfs or on the
+// host), and returns only on failure.
+int fork(void);
+int exec(const char *path);
+int wait(int *status);
+int waitpid(int pid, int *status);
+int getpid(void);
+
+// buffered standard output (user/user_stdio.c). the output is fully buffered by default,
+// and flushed when the buffer fills up, by flush(), and by exit().
+#define _IOFBF 0  // fully buffered
+#define _IOLBF 1  // line buffered: also flushed after every line
+#define _IONBF 2  // unbuffered
+// buffer sizes accepted by setvbuf_stdout().
+#define STDOUT_BUF_MIN 4096
+#define STDOUT_BUF_MAX 65536
+
+int printu(const char *s, ...);
+int setvbuf_stdout(int mode, uint64 size);
+int flush(void);
+
+// raw heap and mapping syscalls. sbrk() and mmap() return (void *)-1 on failure.
+void *sbrk(long increment);
+void *mmap(void *addr, uint64 length, int prot);
+int munmap(void *addr, uint64 length);
+
+// the heap allocator (user/user_malloc.c).
+void *malloc(uint64 size);
+void free(void *ptr);
+void *calloc(uint64 nmemb, uint64 size);
+void *realloc(void *ptr, uint64 size);
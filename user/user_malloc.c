@@ -0,0 +1,197 @@
+/*
+ * the heap allocator of applications.
+ *
+ * small requests (up to MALLOC_SMALL_MAX bytes, header included) are rounded up to one of
+ * NR_CLASSES size classes: 16-byte steps up to 128 bytes, then four classes per power of
+ * two. every class has a small bounded cache of free blocks (tcache) in front of an
+ * unbounded central free list, in the style of per-thread caches: malloc and free mostly
+ * push and pop the cache, and blocks move between the cache and the central list in
+ * batches. new blocks are carved from arena chunks obtained by sbrk().
+ *
+ * larger requests are passed through to mmap(), and given back by munmap() when freed.
+ */
+
+#include "user_lib.h"
+#include "util/types.h"
+#include "util/string.h"
+#include "util/functions.h"
+
+#define PGSIZE 4096
+
+// every block starts with a header (keeping the payload 16-byte aligned).
+#define MALLOC_HDR_SIZE 16
+#define MALLOC_SMALL_MAX 32768
+#define NR_CLASSES 40
+// capacity of a tcache, and number of blocks moved to/from the central list at once.
+#define TCACHE_MAX 32
+#define TCACHE_BATCH 16
+// sbrk() grows the arena by chunks of this size.
+#define ARENA_CHUNK 0x10000
+
+// marks the header of a block mapped by mmap(), whose size is kept in the header.
+#define MALLOC_HUGE (1UL << 63)
+
+typedef struct block_hdr_t {
+  // size class of the block, or MALLOC_HUGE | length of the mapping.
+  uint64 tag;
+  uint64 pad;
+} block_hdr;
+
+// free blocks are linked through their first word.
+typedef struct free_block_t {
+  struct free_block_t *next;
+} free_block;
+
+typedef struct tcache_t {
+  int count;
+  free_block *head;
+} tcache;
+
+static tcache tcaches[NR_CLASSES];
+static free_block *central[NR_CLASSES];
+static char *arena_cur, *arena_end;
+
+//
+// size of the blocks of class c.
+//
+static uint64 class_size(int c) {
+  if (c < 8) return 16 * (c + 1);
+  uint64 base = 128UL << ((c - 8) / 4);
+  return base + ((c - 8) % 4 + 1) * (base / 4);
+}
+
+//
+// smallest class whose blocks hold n (0 < n <= MALLOC_SMALL_MAX) bytes.
+//
+static int size_to_class(uint64 n) {
+  if (n <= 128) return (n + 15) / 16 - 1;
+  int k = 0;
+  while ((128UL << (k + 1)) < n) k++;
+  uint64 base = 128UL << k;
+  return 8 + 4 * k + (n - base - 1) / (base / 4);
+}
+
+//
+// carve a block of size bytes from the arena, growing it with sbrk() when exhausted.
+//
+static void *arena_alloc(uint64 size) {
+  if (arena_cur + size > arena_end) {
+    char *chunk = sbrk(ARENA_CHUNK);
+    if (chunk == (char *)-1) return NULL;
+    // the heap is contiguous, so the remainder of the old chunk can still be used.
+    if (chunk != arena_end) arena_cur = chunk;
+    arena_end = chunk + ARENA_CHUNK;
+  }
+  void *blk = arena_cur;
+  arena_cur += size;
+  return blk;
+}
+
+//
+// fill the tcache of class c from the central list, or else from the arena.
+//
+static void tcache_refill(int c) {
+  tcache *tc = &tcaches[c];
+  while (tc->count < TCACHE_BATCH) {
+    free_block *b = central[c];
+    if (b) {
+      central[c] = b->next;
+    } else if ((b = arena_alloc(class_size(c))) == NULL) {
+      return;
+    }
+    b->next = tc->head;
+    tc->head = b;
+    tc->count++;
+  }
+}
+
+//
+// return a batch of blocks of a full tcache to the central list.
+//
+static void tcache_flush(int c) {
+  tcache *tc = &tcaches[c];
+  for (int i = 0; i < TCACHE_BATCH; i++) {
+    free_block *b = tc->head;
+    tc->head = b->next;
+    b->next = central[c];
+    central[c] = b;
+  }
+  tc->count -= TCACHE_BATCH;
+}
+
+void *malloc(uint64 size) {
+  if (size == 0 || size > (1UL << 40)) return NULL;
+  uint64 n = size + MALLOC_HDR_SIZE;
+
+  block_hdr *hdr;
+  if (n > MALLOC_SMALL_MAX) {
+    n = ROUNDUP(n, PGSIZE);
+    hdr = mmap(NULL, n, PROT_READ | PROT_WRITE);
+    if (hdr == (void *)-1) return NULL;
+    hdr->tag = MALLOC_HUGE | n;
+  } else {
+    int c = size_to_class(n);
+    tcache *tc = &tcaches[c];
+    if (tc->head == NULL) {
+      tcache_refill(c);
+      if (tc->head == NULL) return NULL;
+    }
+    hdr = (block_hdr *)tc->head;
+    tc->head = tc->head->next;
+    tc->count--;
+    hdr->tag = c;
+  }
+  return (char *)hdr + MALLOC_HDR_SIZE;
+}
+
+void free(void *ptr) {
+  if (ptr == NULL) return;
+  block_hdr *hdr = (block_hdr *)((char *)ptr - MALLOC_HDR_SIZE);
+
+  if (hdr->tag & MALLOC_HUGE) {
+    munmap(hdr, hdr->tag & ~MALLOC_HUGE);
+    return;
+  }
+
+  int c = hdr->tag;
+  tcache *tc = &tcaches[c];
+  if (tc->count == TCACHE_MAX) tcache_flush(c);
+  free_block *b = (free_block *)hdr;
+  b->next = tc->head;
+  tc->head = b;
+  tc->count++;
+}
+
+//
+// usable size of the block of ptr.
+//
+static uint64 block_size(void *ptr) {
+  block_hdr *hdr = (block_hdr *)((char *)ptr - MALLOC_HDR_SIZE);
+  uint64 n = (hdr->tag & MALLOC_HUGE) ? hdr->tag & ~MALLOC_HUGE : class_size(hdr->tag);
+  return n - MALLOC_HDR_SIZE;
+}
+
+void *calloc(uint64 nmemb, uint64 size) {
+  if (size && nmemb > (uint64)-1 / size) return NULL;
+  void *ptr = malloc(nmemb * size);
+  // mmap() returns zeroed pages already.
+  if (ptr && nmemb * size + MALLOC_HDR_SIZE <= MALLOC_SMALL_MAX) memset(ptr, 0, nmemb * size);
+  return ptr;
+}
+
+void *realloc(void *ptr, uint64 size) {
+  if (ptr == NULL) return malloc(size);
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  uint64 old = block_size(ptr);
+  if (size <= old) return ptr;
+
+  void *p = malloc(size);
+  if (p == NULL) return NULL;
+  memcpy(p, ptr, old);
+  free(ptr);
+  return p;
+}
@@ -0,0 +1,142 @@
+/*
+ * buffered standard output of applications.
+ *
+ * printu() formats straight into the stdout buffer, so that a message costs no syscall
+ * until the buffer is flushed. a flush drains the buffer with one write. a message that
+ * does not fit is sent together with the buffered bytes by a single writev, instead of
+ * two separate writes.
+ */
+
+#include "user_lib.h"
+#include "util/types.h"
+#include "util/string.h"
+#include "util/snprintf.h"
+
+static char default_buf[STDOUT_BUF_MIN];
+
+static char *out_buf = default_buf;
+static uint64 out_size = STDOUT_BUF_MIN;  // capacity of out_buf
+static uint64 out_len;                     // bytes waiting in out_buf
+static int out_mode = _IOFBF;
+
+//
+// write the segments of iov completely, resuming after partial writes.
+//
+static int write_all(struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    long r = writev(1, iov, iovcnt);
+    if (r <= 0) return -1;
+    // skip the segments (and the part of a segment) that went out.
+    while (iovcnt > 0 && r >= iov->iov_len) {
+      r -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + r;
+      iov->iov_len -= r;
+    }
+  }
+  return 0;
+}
+
+//
+// write the buffered output to stdout.
+//
+int flush(void) {
+  if (out_len == 0) return 0;
+  struct iovec iov = {out_buf, out_len};
+  out_len = 0;
+  return write_all(&iov, 1);
+}
+
+static int has_newline(const char *s, uint64 n) {
+  for (uint64 i = 0; i < n; i++)
+    if (s[i] == '\n') return 1;
+  return 0;
+}
+
+//
+// flush after n bytes at s were put into the buffer, if the buffer or the mode wants it.
+//
+static int after_append(const char *s, uint64 n) {
+  if (out_len == out_size || (out_mode == _IOLBF && has_newline(s, n))) return flush();
+  return 0;
+}
+
+//
+// send n bytes at s to stdout, through the buffer if they fit in it.
+//
+static int stdout_put(const char *s, uint64 n) {
+  if (out_mode != _IONBF && out_len + n <= out_size) {
+    memcpy(out_buf + out_len, s, n);
+    out_len += n;
+    return after_append(s, n);
+  }
+
+  // the bytes do not fit: send them right behind the buffered ones, in one syscall.
+  struct iovec iov[2] = {{out_buf, out_len}, {(void *)s, n}};
+  int first = out_len ? 0 : 1;
+  out_len = 0;
+  return write_all(iov + first, 2 - first);
+}
+
+//
+// select the buffering mode (_IOFBF, _IOLBF or _IONBF) and the size of the stdout buffer.
+// size 0 keeps the current buffer. returns 0 on success.
+//
+int setvbuf_stdout(int mode, uint64 size) {
+  if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF) return -1;
+  if (size && (size < STDOUT_BUF_MIN || size > STDOUT_BUF_MAX)) return -1;
+  if (flush() != 0) return -1;
+
+  if (size && size != out_size) {
+    char *buf = size == STDOUT_BUF_MIN ? default_buf : malloc(size);
+    if (buf == NULL) return -1;
+    if (out_buf != default_buf) free(out_buf);
+    out_buf = buf;
+    out_size = size;
+  }
+  out_mode = mode;
+  return 0;
+}
+
+//
+// printu() supports user/lab1_1_helloworld.c
+//
+int printu(const char *s, ...) {
+  va_list vl, vl2;
+  va_start(vl, s);
+  va_copy(vl2, vl);
+
+  // format right into the free space of the buffer.
+  char small[256];
+  int res;
+  if (out_mode != _IONBF) {
+    res = vsnprintf(out_buf + out_len, out_size - out_len, s, vl);
+    if (res >= 0 && res < out_size - out_len) {
+      out_len += res;
+      va_end(vl);
+      va_end(vl2);
+      return after_append(out_buf + out_len - res, res) == 0 ? res : -1;
+    }
+  } else {
+    res = vsnprintf(small, sizeof(small), s, vl);
+  }
+  va_end(vl);
+
+  // the message does not fit in the buffer (or there is none). format it separately,
+  // in a heap block if it is too long for the stack.
+  char *out = small;
+  if (res >= 0 && res + 1 > sizeof(small) && (out = malloc(res + 1)) == NULL) out = small;
+  uint64 n = 0;
+  if (res >= 0) {
+    vsnprintf(out, out == small ? sizeof(small) : res + 1, s, vl2);
+    n = out == small && res >= sizeof(small) ? sizeof(small) - 1 : res;
+  }
+  va_end(vl2);
+
+  int r = res < 0 ? -1 : stdout_put(out, n);
+  if (out != small) free(out);
+  return r == 0 ? res : -1;
+}
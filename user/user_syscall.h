@@ -0,0 +1,98 @@
+/*
+ * the syscall stubs of the user library, one static inline function per syscall,
+ * generated at compile time from the syscall table of the kernel (kernel/syscall_table.h),
+ * so that both always agree on the numbers and the arguments.
+ *
+ * syscall_<name>(...) takes exactly the arguments of syscall SYS_user_<name>, and returns
+ * its 64-bit result: a negative errno value on failure (see kernel/syscall.h). the number
+ * goes in a0 and the arguments in a1 ... a6, pinned by the asm operands. the kernel
+ * preserves every other register across the ecall, so only memory is clobbered.
+ */
+#ifndef _USER_SYSCALL_H_
+#define _USER_SYSCALL_H_
+
+#include "kernel/syscall.h"
+
+static inline long __syscall0(long n) {
+  register long a0 asm("a0") = n;
+  asm volatile("ecall" : "+r"(a0) : : "memory");
+  return a0;
+}
+
+static inline long __syscall1(long n, long x1) {
+  register long a0 asm("a0") = n, a1 asm("a1") = x1;
+  asm volatile("ecall" : "+r"(a0) : "r"(a1) : "memory");
+  return a0;
+}
+
+static inline long __syscall2(long n, long x1, long x2) {
+  register long a0 asm("a0") = n, a1 asm("a1") = x1, a2 asm("a2") = x2;
+  asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a2) : "memory");
+  return a0;
+}
+
+static inline long __syscall3(long n, long x1, long x2, long x3) {
+  register long a0 asm("a0") = n, a1 asm("a1") = x1, a2 asm("a2") = x2, a3 asm("a3") = x3;
+  asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a2), "r"(a3) : "memory");
+  return a0;
+}
+
+static inline long __syscall4(long n, long x1, long x2, long x3, long x4) {
+  register long a0 asm("a0") = n, a1 asm("a1") = x1, a2 asm("a2") = x2, a3 asm("a3") = x3;
+  register long a4 asm("a4") = x4;
+  asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a2), "r"(a3), "r"(a4) : "memory");
+  return a0;
+}
+
+static inline long __syscall5(long n, long x1, long x2, long x3, long x4, long x5) {
+  register long a0 asm("a0") = n, a1 asm("a1") = x1, a2 asm("a2") = x2, a3 asm("a3") = x3;
+  register long a4 asm("a4") = x4, a5 asm("a5") = x5;
+  asm volatile("ecall" : "+r"(a0) : "r"(a1), "r"(a2), "r"(a3), "r"(a4), "r"(a5) : "memory");
+  return a0;
+}
+
+static inline long __syscall6(long n, long x1, long x2, long x3, long x4, long x5, long x6) {
+  register long a0 asm("a0") = n, a1 asm("a1") = x1, a2 asm("a2") = x2, a3 asm("a3") = x3;
+  register long a4 asm("a4") = x4, a5 asm("a5") = x5, a6 asm("a6") = x6;
+  asm volatile("ecall"
+               : "+r"(a0)
+               : "r"(a1), "r"(a2), "r"(a3), "r"(a4), "r"(a5), "r"(a6)
+               : "memory");
+  return a0;
+}
+
+// the stub of a syscall, by its arity.
+#define SYSCALL_STUB_0(name)                \
+  static inline long syscall_##name(void) { \
+    return __syscall0(SYS_user_##name);     \
+  }
+#define SYSCALL_STUB_1(name)                   \
+  static inline long syscall_##name(long x1) { \
+    return __syscall1(SYS_user_##name, x1);    \
+  }
+#define SYSCALL_STUB_2(name)                            \
+  static inline long syscall_##name(long x1, long x2) { \
+    return __syscall2(SYS_user_##name, x1, x2);         \
+  }
+#define SYSCALL_STUB_3(name)                                     \
+  static inline long syscall_##name(long x1, long x2, long x3) { \
+    return __syscall3(SYS_user_##name, x1, x2, x3);              \
+  }
+#define SYSCALL_STUB_4(name)                                              \
+  static inline long syscall_##name(long x1, long x2, long x3, long x4) { \
+    return __syscall4(SYS_user_##name, x1, x2, x3, x4);                   \
+  }
+#define SYSCALL_STUB_5(name)                                                       \
+  static inline long syscall_##name(long x1, long x2, long x3, long x4, long x5) { \
+    return __syscall5(SYS_user_##name, x1, x2, x3, x4, x5);                        \
+  }
+#define SYSCALL_STUB_6(name)                                                                \
+  static inline long syscall_##name(long x1, long x2, long x3, long x4, long x5, long x6) { \
+    return __syscall6(SYS_user_##name, x1, x2, x3, x4, x5, x6);                             \
+  }
+
+#define SYSCALL_STUB(name, nr, nargs, flags, types) SYSCALL_STUB_##nargs(name)
+SYSCALL_TABLE(SYSCALL_STUB)
+#undef SYSCALL_STUB
+
+#endif
@@ -30,7 +30,20 @@ void* memset(void* dest, int byte, size_t len) {
     word |= word << 16 << 16;
 
     uintptr_t* d = dest;
-    while (d < (uintptr_t*)(dest + len)) *d++ = word;
+    uintptr_t* end = (uintptr_t*)(dest + len);
+    // fill 8 words per iteration for the bulk, e.g., when zero-filling whole pages.
+    while (d + 8 <= end) {
+      d[0] = word;
+      d[1] = word;
+      d[2] = word;
+      d[3] = word;
+      d[4] = word;
+      d[5] = word;
+      d[6] = word;
+      d[7] = word;
+      d += 8;
+    }
+    while (d < end) *d++ = word;
   } else {
     char* d = dest;
     while (d < (char*)(dest + len)) *d++ = byte;